@@ -0,0 +1,108 @@
+#include "autotune.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <unistd.h>
+
+BufferTuner::BufferTuner(std::size_t tuned_size)
+: current(tuned_size ? tuned_size : min_size)
+, best(tuned_size)
+, done(tuned_size != 0) {}
+
+std::size_t BufferTuner::size() const {
+    return current;
+}
+
+bool BufferTuner::settled() const {
+    return done;
+}
+
+void BufferTuner::observe(std::size_t bytes, std::chrono::steady_clock::duration elapsed) {
+    if (done) {
+        return;
+    }
+    step_bytes += bytes;
+    step_elapsed += elapsed;
+
+    // A few buffers' worth, but at least enough to smooth over the noise of
+    // individual system calls.
+    const std::size_t enough = std::max<std::size_t>(4 * current, 8 * 1024 * 1024);
+    if (step_bytes < enough) {
+        return;
+    }
+
+    const double rate = step_bytes / std::max(1e-9, std::chrono::duration<double>(step_elapsed).count());
+    if (rate > best_rate) {
+        best_rate = rate;
+        best = current;
+        slower_steps = 0;
+    } else if (rate < 0.9 * best_rate) {
+        ++slower_steps;
+    } else {
+        slower_steps = 0;
+    }
+    step_bytes = 0;
+    step_elapsed = {};
+
+    // Two clearly slower steps in a row means we're past the peak.
+    if (current >= max_size || slower_steps == 2) {
+        current = best;
+        done = true;
+    } else {
+        current *= 2;
+    }
+}
+
+std::size_t load_tuned_size(const std::string& path, std::uint64_t source_device, std::uint64_t destination_device) {
+    std::ifstream in{path};
+    std::uint64_t source;
+    std::uint64_t destination;
+    std::size_t size;
+    while (in >> source >> destination >> size) {
+        if (source == source_device && destination == destination_device) {
+            return std::clamp(size, BufferTuner::min_size, BufferTuner::max_size);
+        }
+    }
+    return 0;
+}
+
+int store_tuned_size(const std::string& path, std::uint64_t source_device, std::uint64_t destination_device, std::size_t size) {
+    std::ostringstream records;
+    {
+        std::ifstream in{path};
+        std::uint64_t source;
+        std::uint64_t destination;
+        std::size_t other_size;
+        while (in >> source >> destination >> other_size) {
+            if (source != source_device || destination != destination_device) {
+                records << source << ' ' << destination << ' ' << other_size << '\n';
+            }
+        }
+    }
+    records << source_device << ' ' << destination_device << ' ' << size << '\n';
+
+    // Replace the file atomically, so that a concurrent copy never sees it
+    // half written. Each process writes its own temporary file, so that
+    // concurrent copies don't write into each other's.
+    const std::string temporary = path + '.' + std::to_string(::getpid()) + ".tmp";
+    {
+        std::ofstream out{temporary, std::ios::trunc};
+        // A stream doesn't say why it failed, and `errno` might be left
+        // over from something else.
+        if (!(out << records.str()) || !out.flush()) {
+            std::remove(temporary.c_str());
+            return EIO;
+        }
+    }
+    if (std::rename(temporary.c_str(), path.c_str())) {
+        const int error = errno;
+        std::remove(temporary.c_str());
+        return error;
+    }
+    return 0;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+// `BufferTuner` chooses a buffer size for a read/write copy loop while the
+// copy is running. It tries each power of two from 64 KiB to 16 MiB in turn,
+// measuring the throughput of each over a few buffers' worth of data, and
+// then settles on the fastest. It stops trying larger sizes early once they
+// are clearly slower than the best so far.
+//
+// The tuned size can be saved in a small state file, keyed by the source and
+// destination devices, so that later copies between the same devices start at
+// the tuned size instead of tuning again. Each line of the file is
+//
+//     <source device> <destination device> <buffer size>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class BufferTuner {
+    std::size_t current;
+    std::size_t best = 0;
+    double best_rate = 0;
+    bool done = false;
+    // how many steps in a row were slower than the best
+    int slower_steps = 0;
+    std::size_t step_bytes = 0;
+    std::chrono::steady_clock::duration step_elapsed{};
+
+ public:
+    static constexpr std::size_t min_size = 64 * 1024;
+    static constexpr std::size_t max_size = 16 * 1024 * 1024;
+
+    // Start tuning, or start settled on `tuned_size` if it is not zero.
+    explicit BufferTuner(std::size_t tuned_size = 0);
+
+    // Return the buffer size to use for the next read.
+    std::size_t size() const;
+
+    // Return whether tuning is finished.
+    bool settled() const;
+
+    // Report that `bytes` were read and written, using a buffer of `size()`
+    // bytes, in `elapsed` time.
+    void observe(std::size_t bytes, std::chrono::steady_clock::duration elapsed);
+};
+
+// Return the buffer size recorded in the state file at `path` for copies from
+// device `source_device` to device `destination_device`, or return zero if
+// there is none.
+std::size_t load_tuned_size(const std::string& path, std::uint64_t source_device, std::uint64_t destination_device);
+
+// Record in the state file at `path` the buffer size `size` for copies from
+// device `source_device` to device `destination_device`, replacing any
+// previous record for those devices. Return zero on success, or return
+// `errno` if an error occurs.
+int store_tuned_size(const std::string& path, std::uint64_t source_device, std::uint64_t destination_device, std::size_t size);
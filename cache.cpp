@@ -0,0 +1,121 @@
+#include "cache.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+CacheWindow::CacheWindow(int source_fd, int destination_fd, std::size_t window, std::size_t offset)
+: source_fd(source_fd)
+, destination_fd(destination_fd)
+, window(window)
+, dropped(offset / posix::page_size() * posix::page_size()) {
+}
+
+int CacheWindow::start(std::size_t size) {
+    // Look at the source in pieces of half a window, which is how much is
+    // dropped at a time.
+    const std::size_t piece = std::max(posix::page_size(), window / 2);
+    for (std::size_t offset = dropped; offset < size; offset += piece) {
+        const std::size_t count = std::min(piece, size - offset);
+        const posix::CacheResidency residency = posix::cache_residency(source_fd, offset, count);
+        // If it can't be told whether a piece is cached, then assume not.
+        if (residency.error || residency.cached_pages == 0) {
+            continue;
+        }
+        if (!hot.empty() && hot.back().second == offset) {
+            hot.back().second = offset + count;
+        } else {
+            hot.emplace_back(offset, offset + count);
+        }
+    }
+    return posix::advise_sequential(source_fd);
+}
+
+int CacheWindow::after_chunk(std::size_t end) {
+    if (end - dropped < window) {
+        return 0;
+    }
+    // Keep the newer half of the window, and start writing it to storage, so
+    // that it's clean by the time it's dropped, rather than making us wait
+    // then.
+    const std::size_t page = posix::page_size();
+    const std::size_t keep_from = (end - window / 2) / page * page;
+    if (const int rc = drop(keep_from)) {
+        return rc;
+    }
+    return posix::start_writeback(destination_fd, keep_from, end - keep_from);
+}
+
+int CacheWindow::finish(std::size_t end) {
+    // Round up, so that the file's last partial page goes too.
+    const std::size_t page = posix::page_size();
+    return drop((end + page - 1) / page * page);
+}
+
+int CacheWindow::drop(std::size_t end) {
+    if (end <= dropped) {
+        return 0;
+    }
+    if (const int rc = posix::drop_cached(destination_fd, dropped, end - dropped)) {
+        return rc;
+    }
+    // Drop the source's pages between its hot ranges.
+    std::size_t begin = dropped;
+    for (const auto& [hot_begin, hot_end] : hot) {
+        if (hot_begin >= end) {
+            break;
+        }
+        if (hot_begin > begin) {
+            if (const int rc = posix::drop_cached(source_fd, begin, hot_begin - begin)) {
+                return rc;
+            }
+        }
+        begin = std::max(begin, hot_end);
+    }
+    if (begin < end) {
+        if (const int rc = posix::drop_cached(source_fd, begin, end - begin)) {
+            return rc;
+        }
+    }
+    std::erase_if(hot, [&](const auto& range) { return range.second <= end; });
+    dropped = end;
+    return 0;
+}
+
+CacheReport::CacheReport(std::string source_path, std::string destination_path)
+: source_path(std::move(source_path))
+, destination_path(std::move(destination_path))
+, source_before(file_cache_residency(this->source_path.c_str()))
+, destination_before(file_cache_residency(this->destination_path.c_str())) {}
+
+void CacheReport::print(std::size_t window, std::ostream& out) const {
+    const posix::CacheResidency source_after = file_cache_residency(source_path.c_str());
+    const posix::CacheResidency destination_after = file_cache_residency(destination_path.c_str());
+    if (const int rc = source_before.error ? source_before.error : destination_before.error ? destination_before.error
+                     : source_after.error ? source_after.error : destination_after.error) {
+        out << "Unable to determine how much of the files is in the page cache: " << std::strerror(rc) << '\n';
+        return;
+    }
+    out << "{\"cache_window\": " << window
+        << ", \"source_pages\": " << source_after.total_pages
+        << ", \"source_cached_before\": " << source_before.cached_pages
+        << ", \"source_cached_after\": " << source_after.cached_pages
+        << ", \"destination_pages\": " << destination_after.total_pages
+        << ", \"destination_cached_before\": " << destination_before.cached_pages
+        << ", \"destination_cached_after\": " << destination_after.cached_pages << "}\n";
+}
+
+posix::CacheResidency file_cache_residency(const char* path) {
+    const int fd = posix::open_for_reading(path);
+    if (fd == -ENOENT) {
+        return {.error = 0, .cached_pages = 0, .total_pages = 0};
+    } else if (fd < 0) {
+        return {.error = -fd, .cached_pages = 0, .total_pages = 0};
+    }
+    const auto [error, status] = posix::file_status(fd);
+    const posix::CacheResidency result = error
+        ? posix::CacheResidency{.error = error, .cached_pages = 0, .total_pages = 0}
+        : posix::cache_residency(fd, 0, status.size);
+    posix::close_file(fd);
+    return result;
+}
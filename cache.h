@@ -0,0 +1,81 @@
+#pragma once
+
+// `CacheWindow` keeps a sequential copy from filling the page cache with data
+// that nobody will read again, without the alignment constraints of
+// `O_DIRECT`. The source is read with a sequential readahead hint, and as the
+// copy proceeds, the pages of both files that are more than a window's worth
+// behind it are dropped from the cache. The destination's pages are written to
+// storage first, since only clean pages can be dropped.
+//
+// Parts of the source that were already cached before the copy began are left
+// alone, since presumably somebody else is using them. So a copy leaves the
+// page cache about as it found it.
+//
+// On Darwin, pages can't be dropped by range, so this only hints readahead.
+
+#include "posix.h"
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+class CacheWindow {
+    int source_fd;
+    int destination_fd;
+    std::size_t window;
+    // where the part of the files whose pages haven't been dropped begins
+    std::size_t dropped;
+    // ranges [first, second) of the source that were cached before being
+    // read, in order
+    std::vector<std::pair<std::size_t, std::size_t>> hot;
+
+    // Drop the pages of both files from `dropped` up to `end`. Return zero on
+    // success, or return `errno` if an error occurs.
+    int drop(std::size_t end);
+
+ public:
+    // Prepare to copy from the file associated with `source_fd` to the file
+    // associated with `destination_fd`, beginning at `offset`, while keeping
+    // at most about `window` bytes of each cached behind the copy.
+    CacheWindow(int source_fd, int destination_fd, std::size_t window, std::size_t offset = 0);
+
+    // Note which parts of the source, which is `size` bytes long, are cached
+    // already, and advise the kernel of the copy. Call this before reading
+    // anything, since reading ahead makes what's about to be read look
+    // cached. Return zero on success, or return `errno` if an error occurs.
+    int start(std::size_t size);
+
+    // Note that everything before `end` has been copied. Return zero on
+    // success, or return `errno` if an error occurs.
+    int after_chunk(std::size_t end);
+
+    // Drop the remaining pages of both files, where the copy ended at `end`.
+    // Return zero on success, or return `errno` if an error occurs.
+    int finish(std::size_t end);
+};
+
+// Return the page cache residency of the whole file indicated by its `path` on
+// the file system, as `posix::cache_residency` does. A file that doesn't exist
+// has no pages.
+posix::CacheResidency file_cache_residency(const char* path);
+
+// `CacheReport` tells how much of a copy's source and destination files were
+// in the page cache before and after the copy.
+class CacheReport {
+    std::string source_path;
+    std::string destination_path;
+    posix::CacheResidency source_before;
+    posix::CacheResidency destination_before;
+
+ public:
+    // Note how much of each file is cached now. Do this before the
+    // destination is truncated.
+    CacheReport(std::string source_path, std::string destination_path);
+
+    // Print to `out` a line of JSON having the residency of each file before
+    // and now, and the `window` with which it was copied, or print why the
+    // residency couldn't be determined.
+    void print(std::size_t window, std::ostream& out) const;
+};
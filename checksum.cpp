@@ -0,0 +1,68 @@
+#include "checksum.h"
+
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+namespace checksum {
+namespace {
+
+// the reflected Castagnoli polynomial
+const std::uint32_t polynomial = 0x82f63b78;
+
+constexpr std::array<std::uint32_t, 256> make_table() {
+    std::array<std::uint32_t, 256> table{};
+    for (std::uint32_t i = 0; i < 256; ++i) {
+        std::uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (crc & 1 ? polynomial : 0);
+        }
+        table[i] = crc;
+    }
+    return table;
+}
+
+const std::array<std::uint32_t, 256> table = make_table();
+
+std::uint32_t crc32c_portable(const char* data, std::size_t count, std::uint32_t crc) {
+    for (std::size_t i = 0; i < count; ++i) {
+        crc = table[(crc ^ static_cast<unsigned char>(data[i])) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+std::uint32_t crc32c_sse42(const char* data, std::size_t count, std::uint32_t crc) {
+    std::uint64_t crc64 = crc;
+    for (; count >= sizeof(std::uint64_t); data += sizeof(std::uint64_t), count -= sizeof(std::uint64_t)) {
+        std::uint64_t word;
+        std::memcpy(&word, data, sizeof word);
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = crc64;
+    for (; count; ++data, --count) {
+        crc = _mm_crc32_u8(crc, static_cast<unsigned char>(*data));
+    }
+    return crc;
+}
+#endif
+
+} // namespace
+
+std::uint32_t crc32c(const char* data, std::size_t count, std::uint32_t crc) {
+    // The conventional CRC-32C inverts its input and output.
+    crc = ~crc;
+#if defined(__x86_64__)
+    static const bool have_sse42 = __builtin_cpu_supports("sse4.2");
+    if (have_sse42) {
+        return ~crc32c_sse42(data, count, crc);
+    }
+#endif
+    return ~crc32c_portable(data, count, crc);
+}
+
+} // namespace checksum
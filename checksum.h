@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace checksum {
+
+// Return the CRC-32C (Castagnoli) of the `count` bytes at `data`, continuing
+// from the CRC `crc` of any preceding bytes. Use `crc = 0` for the first
+// bytes. This uses the SSE 4.2 CRC instruction when the CPU has it.
+std::uint32_t crc32c(const char* data, std::size_t count, std::uint32_t crc = 0);
+
+} // namespace checksum
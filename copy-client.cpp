@@ -0,0 +1,194 @@
+#include "copyd.h"
+#include "posix.h"
+
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <signal.h>
+
+struct Options {
+    bool help = false;
+    std::string socket = copyd::default_socket_path;
+    // (source, destination) pairs
+    std::vector<std::pair<std::string, std::string>> jobs;
+};
+
+void usage(std::string_view name, std::ostream& out);
+
+int parse_command_line(Options& options, int argc, char* argv[], std::ostream& out, std::ostream& error);
+
+// Read (source, destination) pairs, one per line and separated by a tab, from
+// `in` into `jobs`. Return zero on success, or return nonzero and print a
+// diagnostic to `error` if a line is malformed.
+int read_jobs(std::vector<std::pair<std::string, std::string>>& jobs, std::istream& in, std::ostream& error);
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (const int rc = parse_command_line(options, argc, argv, std::cout, std::cerr)) {
+        return rc;
+    } else if (options.help) {
+        return 0; // `parse_command_line` printed the usage already
+    }
+    if (options.jobs.empty()) {
+        if (const int rc = read_jobs(options.jobs, std::cin, std::cerr)) {
+            return rc;
+        }
+    }
+
+    class Closer {
+        int fd;
+     public:
+        explicit Closer(int fd) : fd(fd) {}
+        ~Closer() {
+            posix::close_file(fd);
+        }
+    };
+
+    const int fd = posix::connect_to_unix_socket(options.socket.c_str());
+    if (fd < 0) {
+        std::cerr << "Unable to connect to copyd at \"" << options.socket << "\": " << std::strerror(-fd) << '\n';
+        return 1;
+    }
+    Closer closer{fd};
+
+    // If copyd goes away, then `write_all` reports `EPIPE` instead of the
+    // signal killing us without a word.
+    ::signal(SIGPIPE, SIG_IGN);
+
+    // Keep at most this many requests outstanding, so that responses we
+    // aren't reading yet don't pile up in the daemon.
+    const std::size_t max_in_flight = 256;
+    std::size_t outstanding = 0;
+    int status = 0;
+
+    const auto receive = [&]() {
+        copyd::Response response;
+        const int rc = posix::read_all(fd, reinterpret_cast<char*>(&response), sizeof response);
+        if (rc != sizeof response) {
+            std::cerr << "Lost connection to copyd: " << (rc < 0 ? std::strerror(-rc) : "unexpected end of stream") << '\n';
+            return false;
+        }
+        if (response.id >= options.jobs.size()) {
+            std::cerr << "copyd sent a response to request " << response.id << ", which was never sent.\n";
+            return false;
+        }
+        --outstanding;
+        if (response.error) {
+            const auto& [source, destination] = options.jobs[response.id];
+            std::cerr << "Unable to copy bytes from \"" << source << "\" to \"" << destination << "\": " << std::strerror(response.error) << '\n';
+            status = 1;
+        }
+        return true;
+    };
+
+    for (std::size_t i = 0; i < options.jobs.size(); ++i) {
+        if (outstanding == max_in_flight && !receive()) {
+            return 1;
+        }
+
+        // `std::filesystem::absolute` does not touch the file system.
+        const std::string source = std::filesystem::absolute(options.jobs[i].first).string();
+        const std::string destination = std::filesystem::absolute(options.jobs[i].second).string();
+        // The daemon hangs up on a request having a longer path.
+        if (source.size() > copyd::max_path_length || destination.size() > copyd::max_path_length) {
+            const std::string& path = source.size() > copyd::max_path_length ? source : destination;
+            std::cerr << "Unable to send request to copyd: \"" << path << "\" is longer than " << copyd::max_path_length << " bytes.\n";
+            status = 1;
+            continue;
+        }
+        const copyd::Request request{
+            .id = i,
+            .source_length = std::uint32_t(source.size()),
+            .destination_length = std::uint32_t(destination.size())};
+        std::string message(reinterpret_cast<const char*>(&request), sizeof request);
+        message += source;
+        message += destination;
+        if (const int rc = posix::write_all(fd, message.data(), message.size()); rc < 0) {
+            std::cerr << "Unable to send request to copyd: " << std::strerror(-rc) << '\n';
+            return 1;
+        }
+        ++outstanding;
+    }
+
+    while (outstanding) {
+        if (!receive()) {
+            return 1;
+        }
+    }
+
+    return status;
+}
+
+int read_jobs(std::vector<std::pair<std::string, std::string>>& jobs, std::istream& in, std::ostream& error) {
+    std::string line;
+    for (int line_number = 1; std::getline(in, line); ++line_number) {
+        if (line.empty()) {
+            continue;
+        }
+        const std::size_t tab = line.find('\t');
+        if (tab == std::string::npos) {
+            error << "error: line " << line_number << " of standard input is not of the form <source file><tab><destination file>.\n";
+            return 1;
+        }
+        jobs.emplace_back(line.substr(0, tab), line.substr(tab + 1));
+    }
+    return 0;
+}
+
+void usage(std::string_view program_name, std::ostream& out) {
+    out << "usage:\n\n"
+        "    " << program_name << " [--help | -h] [--socket PATH] [<source file> <destination file> ...]\n\n"
+        "        --help or -h prints this message.\n"
+        "        PATH is the Unix domain socket on which copyd is listening. It defaults to \"" << copyd::default_socket_path << "\".\n"
+        "        <source file> is the path to an input file, to be read from.\n"
+        "        <destination file> is the path to an output file, to be created/truncated and written to.\n\n"
+        "    If no files are given, then read them from standard input, one pair per line, separated by a tab.\n";
+}
+
+int parse_command_line(Options& options, int /* argc */, char* argv[], std::ostream& out, std::ostream& error) {
+    const std::string_view program_name =  argv[0];
+
+    std::string source;
+    bool found_source = false;
+
+    for (++argv; *argv; ++argv) {
+        const std::string_view arg = *argv;
+        if (arg == "--help" || arg == "-h") {
+            options.help = true;
+            usage(program_name, out);
+            return 0;
+        } else if (arg == "--socket") {
+            ++argv;
+            if (!*argv) {
+                usage(program_name, error);
+                error << "\nerror: --socket requires a path argument.\n";
+                return 1;
+            }
+            options.socket = *argv;
+        } else if (arg.substr(0, 1) == "-") {
+            usage(program_name, error);
+            error << "\nerror: Unknown option \"" << arg << "\". If you meant a file name, use \"./" << arg << "\".\n";
+            return 1;
+        } else if (found_source) {
+            options.jobs.emplace_back(std::move(source), arg);
+            found_source = false;
+        } else {
+            source = arg;
+            found_source = true;
+        }
+    }
+
+    if (found_source) {
+        usage(program_name, error);
+        error << "\nerror: \"" << source << "\" has no corresponding destination file.\n";
+        return 1;
+    }
+
+    return 0;
+}
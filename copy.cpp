@@ -1,22 +1,76 @@
+#include "cache.h"
+#include "metrics.h"
 #include "posix.h"
+#include "throttle.h"
 
+#include <chrono>
+#include <cstdint>
 #include <cstring>
 #include <exception>
 #include <iostream>
+#include <optional>
 #include <ostream>
 #include <string>
 #include <string_view>
 
+#include <signal.h>
+
 struct Options {
     bool help = false;
     std::string source;
     std::string destination;
+    ThrottleOptions throttle;
+    bool set_io_priority = false;
+    posix::IoClass io_class = posix::IoClass::BEST_EFFORT;
+    int io_level = 4;
+    MetricsOptions metrics;
+    // With `receive`, `source` is a socket address on which to listen.
+    bool receive = false;
+    bool zero_copy = false;
+    bool preserve = false;
+    bool cache_neutral = false;
+    std::size_t cache_window = 16 * 1024 * 1024;
+};
+
+// A socket given on the command line as "tcp:HOST:PORT" or "unix:PATH"
+struct SocketAddress {
+    bool tcp;
+    std::string host;
+    std::string port;
+    std::string path;
 };
 
+// A sender begins with a header of this many bytes: the file's size (8 bytes)
+// and mode (4 bytes) in network byte order, and 4 reserved bytes. The
+// receiver ends with its status: an `errno` value (4 bytes), zero on success.
+constexpr std::size_t header_size = 16;
+constexpr std::size_t status_size = 4;
+
 void usage(std::string_view name, std::ostream& out);
 
 int parse_command_line(Options& options, int argc, char* argv[], std::ostream& out, std::ostream& error);
 
+// Parse `text` as a socket address into `address`. Return whether `text` is a
+// socket address.
+bool parse_socket_address(std::string_view text, SocketAddress& address);
+
+// Store `value` in the `size` bytes at `destination`, most significant first.
+void store_big_endian(unsigned char* destination, std::uint64_t value, std::size_t size);
+
+// Return the value stored in the `size` bytes at `source`, most significant
+// first.
+std::uint64_t load_big_endian(const unsigned char* source, std::size_t size);
+
+// Send the file at `source` to a receiver listening on `address`, and wait for
+// the receiver to finish writing it. Return zero on success, or return `errno`
+// if an error occurs here or in the receiver.
+int send_to_socket(const std::string& source, const SocketAddress& address, const posix::CopyOptions& copy_options);
+
+// Accept one connection on `address` and write the file sent over it to
+// `destination`. Return zero on success, or return `errno` if an error
+// occurs.
+int receive_from_socket(const SocketAddress& address, const std::string& destination, const posix::CopyOptions& copy_options);
+
 int main(int argc, char* argv[]) {
     Options options;
     if (const int rc = parse_command_line(options, argc, argv, std::cout, std::cerr)) {
@@ -25,23 +79,277 @@ int main(int argc, char* argv[]) {
         return 0; // `parse_command_line` printed the usage already
     }
 
-    if (const int rc = posix::copy_all(options.source.c_str(), options.destination.c_str())) {
-        std::cerr << "Unable to copy bytes from \"" << options.source << "\" to \"" << options.destination << "\": " << std::strerror(rc) << '\n';
-        return 1;
+    if (options.set_io_priority) {
+        if (const int rc = posix::set_io_priority(options.io_class, options.io_level)) {
+            std::cerr << "Unable to set I/O priority: " << std::strerror(rc) << '\n';
+            return 1;
+        }
+    }
+
+    Metrics metrics{options.metrics};
+    ThreadCounters* counters = nullptr;
+    if (metrics.enabled()) {
+        if (const int rc = metrics.start()) {
+            std::cerr << "Unable to export metrics: " << std::strerror(rc) << '\n';
+            return 1;
+        }
+        counters = &metrics.thread_counters();
+    }
+
+    posix::CopyOptions copy_options;
+    Throttle throttle{options.throttle};
+    std::chrono::steady_clock::time_point chunk_began;
+    if (throttle.enabled() || counters) {
+        // Metrics need chunks too, so that progress is visible during a
+        // large copy.
+        copy_options.chunk_size = throttle.suggested_chunk_size(64 * 1024 * 1024);
+        copy_options.before_chunk = [&](std::size_t count) {
+            if (throttle.enabled()) {
+                throttle.acquire(count);
+                chunk_began = std::chrono::steady_clock::now();
+            }
+        };
+        copy_options.after_chunk = [&](std::size_t count) {
+            if (throttle.enabled()) {
+                throttle.observe(std::chrono::steady_clock::now() - chunk_began);
+            }
+            if (counters) {
+                counters->add(Counter::COPY_CALLS, 1);
+                counters->add(Counter::BYTES_COPIED, count);
+            }
+        };
+    }
+
+    copy_options.zero_copy = options.zero_copy;
+    copy_options.preserve = options.preserve;
+    copy_options.cache_window = options.cache_neutral ? options.cache_window : 0;
+
+    SocketAddress address;
+    if (options.receive) {
+        // A sender that goes away must not kill us before we can report why
+        // the copy failed. Writing the reply will fail with `EPIPE` instead.
+        ::signal(SIGPIPE, SIG_IGN);
+        parse_socket_address(options.source, address);
+        if (const int rc = receive_from_socket(address, options.destination, copy_options)) {
+            std::cerr << "Unable to receive \"" << options.destination << "\" on \"" << options.source << "\": " << std::strerror(rc) << '\n';
+            return 1;
+        }
+    } else if (parse_socket_address(options.destination, address)) {
+        // A receiver that goes away must not kill us. `send_file` will
+        // report `EPIPE` instead.
+        ::signal(SIGPIPE, SIG_IGN);
+        if (const int rc = send_to_socket(options.source, address, copy_options)) {
+            std::cerr << "Unable to send \"" << options.source << "\" to \"" << options.destination << "\": " << std::strerror(rc) << '\n';
+            return 1;
+        }
+    } else {
+        // Look at the destination before it's truncated.
+        std::optional<CacheReport> cache_report;
+        if (options.cache_neutral) {
+            cache_report.emplace(options.source, options.destination);
+        }
+        if (const int rc = posix::copy_all(options.source.c_str(), options.destination.c_str(), copy_options)) {
+            std::cerr << "Unable to copy bytes from \"" << options.source << "\" to \"" << options.destination << "\": " << std::strerror(rc) << '\n';
+            return 1;
+        }
+        if (cache_report) {
+            // Standard output might be mixed with `jsontime`'s, so report on
+            // standard error.
+            cache_report->print(options.cache_window, std::cerr);
+        }
+    }
+
+    if (counters) {
+        counters->add(Counter::FILES_COPIED, 1);
+        // The copy succeeded, so don't fail it over the last export.
+        if (const int rc = metrics.stop()) {
+            std::cerr << "Unable to write metrics to \"" << options.metrics.path << "\": " << std::strerror(rc) << '\n';
+        }
+    }
+}
+
+bool parse_socket_address(std::string_view text, SocketAddress& address) {
+    if (text.substr(0, 5) == "unix:") {
+        address = {.tcp = false, .host = {}, .port = {}, .path = std::string(text.substr(5))};
+        return true;
+    }
+    if (text.substr(0, 4) != "tcp:") {
+        return false;
+    }
+    text.remove_prefix(4);
+    const std::size_t colon = text.rfind(':');
+    if (colon == std::string_view::npos) {
+        return false;
+    }
+    std::string_view host = text.substr(0, colon);
+    // IPv6 addresses are written in brackets, e.g. "tcp:[::1]:9000".
+    if (host.size() >= 2 && host.front() == '[' && host.back() == ']') {
+        host = host.substr(1, host.size() - 2);
+    }
+    address = {.tcp = true, .host = std::string(host), .port = std::string(text.substr(colon + 1)), .path = {}};
+    return true;
+}
+
+void store_big_endian(unsigned char* destination, std::uint64_t value, std::size_t size) {
+    for (std::size_t i = size; i > 0; --i) {
+        destination[i - 1] = value & 0xff;
+        value >>= 8;
+    }
+}
+
+std::uint64_t load_big_endian(const unsigned char* source, std::size_t size) {
+    std::uint64_t value = 0;
+    for (std::size_t i = 0; i < size; ++i) {
+        value = value << 8 | source[i];
+    }
+    return value;
+}
+
+int send_to_socket(const std::string& source, const SocketAddress& address, const posix::CopyOptions& copy_options) {
+    class Closer {
+        int fd;
+     public:
+        explicit Closer(int fd) : fd(fd) {}
+        ~Closer() {
+            posix::close_file(fd);
+        }
+    };
+
+    const int file_fd = posix::open_for_reading(source.c_str());
+    if (file_fd < 0) {
+        return -file_fd;
+    }
+    Closer file_closer{file_fd};
+    const auto [error, status] = posix::file_status(file_fd);
+    if (error) {
+        return error;
+    }
+
+    // An empty host means the local host.
+    const char* const host = address.host.empty() ? nullptr : address.host.c_str();
+    const int socket_fd = address.tcp ? posix::connect_to_tcp(host, address.port.c_str())
+                                      : posix::connect_to_unix_socket(address.path.c_str());
+    if (socket_fd < 0) {
+        return -socket_fd;
+    }
+    Closer socket_closer{socket_fd};
+
+    unsigned char header[header_size] = {};
+    store_big_endian(header, status.size, 8);
+    store_big_endian(header + 8, status.mode, 4);
+    const int rc = posix::write_all(socket_fd, reinterpret_cast<const char*>(header), sizeof header);
+    int send_error = rc < 0 ? -rc : posix::send_file(socket_fd, file_fd, status.size, copy_options);
+
+    // If the receiver failed, it said why before disconnecting, and that's
+    // more useful than "broken pipe."
+    unsigned char reply[status_size];
+    if (posix::read_all(socket_fd, reinterpret_cast<char*>(reply), sizeof reply) == int(sizeof reply)) {
+        if (const int receiver_error = load_big_endian(reply, sizeof reply)) {
+            return receiver_error;
+        }
+    } else if (!send_error) {
+        send_error = ECONNRESET;
+    }
+    return send_error;
+}
+
+int receive_from_socket(const SocketAddress& address, const std::string& destination, const posix::CopyOptions& copy_options) {
+    class Closer {
+        int fd;
+     public:
+        explicit Closer(int fd) : fd(fd) {}
+        ~Closer() {
+            posix::close_file(fd);
+        }
+    };
+
+    // An empty host means every local address.
+    const char* const host = address.host.empty() ? nullptr : address.host.c_str();
+    const int listener = address.tcp ? posix::listen_on_tcp(host, address.port.c_str())
+                                     : posix::listen_on_unix_socket(address.path.c_str());
+    if (listener < 0) {
+        return -listener;
+    }
+    Closer listener_closer{listener};
+    const int socket_fd = posix::accept_connection(listener);
+    if (!address.tcp) {
+        posix::remove_file(address.path.c_str());
+    }
+    if (socket_fd < 0) {
+        return -socket_fd;
     }
+    Closer socket_closer{socket_fd};
+
+    unsigned char header[header_size];
+    const int count = posix::read_all(socket_fd, reinterpret_cast<char*>(header), sizeof header);
+    if (count < 0) {
+        return -count;
+    } else if (count != int(sizeof header)) {
+        return ECONNRESET;
+    }
+    const std::size_t size = load_big_endian(header, 8);
+    // Anybody who can connect can send, so don't let them create setuid,
+    // setgid, or sticky files.
+    const unsigned mode = load_big_endian(header + 8, 4) & 0777;
+
+    int error;
+    const int file_fd = posix::open_for_writing(destination.c_str(), mode);
+    if (file_fd < 0) {
+        error = -file_fd;
+    } else {
+        error = posix::receive_file(socket_fd, file_fd, size, copy_options);
+        posix::close_file(file_fd);
+    }
+
+    // Tell the sender how it went. If it's gone, then it already knows that
+    // something went wrong.
+    unsigned char reply[status_size];
+    store_big_endian(reply, error, sizeof reply);
+    posix::write_all(socket_fd, reinterpret_cast<const char*>(reply), sizeof reply);
+    return error;
 }
 
 void usage(std::string_view program_name, std::ostream& out) {
     out << "usage:\n\n"
-        "    " << program_name << " [--help | -h] <source file> <destination file>\n\n"
+        "    " << program_name << " [--help | -h] [--rate BYTES] [--iops COUNT] [--adaptive] [--ioprio CLASS]\n"
+        "        [--metrics DEST [--metrics-interval MILLIS]] [--zerocopy] [--preserve]\n"
+        "        [--cache-neutral [--cache-window BYTES]] <source file> <destination>\n"
+        "    " << program_name << " [--help | -h] [options...] --receive <address> <destination file>\n\n"
         "        --help or -h prints this message.\n"
+        "        BYTES is the most bytes to copy per second. By default, there's no limit.\n"
+        "        COUNT is the most sendfile() calls per second. By default, there's no limit.\n"
+        "        --adaptive halves the rate whenever copy latency rises, and then recovers gradually.\n"
+        "            BYTES is then the greatest rate. It requires --rate.\n"
+        "        CLASS is the I/O scheduling class: \"idle\", \"best-effort\", or \"best-effort:LEVEL\",\n"
+        "            where LEVEL is 0 (highest) to 7 (lowest). By default, it's inherited.\n"
+        "        --metrics exports live metrics in the OpenMetrics text format to DEST, which is either a file,\n"
+        "            replaced every MILLIS milliseconds (default 1000) and at the end, or \"unix:PATH\", a Unix\n"
+        "            domain socket that sends the metrics to each client that connects.\n"
+        "        --zerocopy sends to a \"tcp:\" destination using MSG_ZEROCOPY instead of sendfile(). It's\n"
+        "            Linux-only, and otherwise ignored.\n"
+        "        --preserve copies the source's extended attributes (including ACLs), ownership, permissions,\n"
+        "            and timestamps to a <destination file>. It's always on for Darwin.\n"
+        "        --cache-neutral keeps a copy to a <destination file> from filling the page cache: the source\n"
+        "            is read with a sequential readahead hint, and pages of both files more than a window\n"
+        "            behind the copy are dropped, except parts of the source that were cached already. How\n"
+        "            much of each file was cached before and after is printed to standard error. It's\n"
+        "            Linux-only, except for the report.\n"
+        "        --cache-window is how many bytes of each file may stay cached behind the copy. It defaults\n"
+        "            to 16777216 (16 mebibytes).\n"
+        "        --receive listens on <address> for one sender, and writes the file that it sends. Anybody who\n"
+        "            can connect may send, as there's no authentication, so listen only on a trusted network or\n"
+        "            on a Unix domain socket in a private directory. An empty TCP HOST means every interface.\n"
+        "            The sender's permission bits are kept, but not setuid, setgid, or sticky bits.\n"
         "        <source file> is the path to the input file, to be read from.\n"
+        "        <destination> is either <destination file> or <address>.\n"
+        "        <address> is \"tcp:HOST:PORT\" (HOST may be empty, or an IPv6 address in brackets) or\n"
+        "            \"unix:PATH\", a Unix domain socket. To copy to a file named like that, use \"./tcp:...\".\n"
         "        <destination file> is the path to the output file, to be created/truncated and written to.\n";
 }
 
 int parse_command_line(Options& options, int argc, char* argv[], std::ostream& out, std::ostream& error) {
     const std::string_view program_name =  argv[0];
-    if (argc < 1 + 1 || argc > 1 + 1 + 2) {
+    if (argc < 1 + 1 || argc > 1 + 1 + 2 + 2 + 1 + 2 + 2 + 2 + 1 + 1 + 1 + 1 + 2 + 2) {
         usage(program_name, error);
         return 1;
     }
@@ -55,6 +363,108 @@ int parse_command_line(Options& options, int argc, char* argv[], std::ostream& o
             options.help = true;
             usage(program_name, out);
             return 0;
+        } else if (arg == "--rate" || arg == "--iops") {
+            ++argv;
+            if (!*argv) {
+                usage(program_name, error);
+                error << "\nerror: " << arg << " requires an integer argument.\n";
+                return 1;
+            }
+            long long value;
+            try {
+                value = std::stoll(*argv);
+            } catch (const std::exception&) {
+                usage(program_name, error);
+                error << "\nerror: \"" << *argv << "\" is not a valid integer argument for " << arg << '\n';
+                return 1;
+            }
+            if (value < 1) {
+                usage(program_name, error);
+                error << "\nerror: " << arg << " argument must be at least 1.\n";
+                return 1;
+            }
+            (arg == "--rate" ? options.throttle.bytes_per_second : options.throttle.operations_per_second) = value;
+        } else if (arg == "--receive") {
+            options.receive = true;
+        } else if (arg == "--zerocopy") {
+            options.zero_copy = true;
+        } else if (arg == "--preserve") {
+            options.preserve = true;
+        } else if (arg == "--cache-neutral") {
+            options.cache_neutral = true;
+        } else if (arg == "--cache-window") {
+            ++argv;
+            if (!*argv) {
+                usage(program_name, error);
+                error << "\nerror: --cache-window requires an integer argument.\n";
+                return 1;
+            }
+            long long value;
+            try {
+                value = std::stoll(*argv);
+            } catch (const std::exception&) {
+                usage(program_name, error);
+                error << "\nerror: \"" << *argv << "\" is not a valid integer argument for --cache-window\n";
+                return 1;
+            }
+            if (value < 65536) {
+                usage(program_name, error);
+                error << "\nerror: --cache-window argument must be at least 65536.\n";
+                return 1;
+            }
+            options.cache_window = value;
+        } else if (arg == "--adaptive") {
+            options.throttle.adaptive = true;
+        } else if (arg == "--ioprio") {
+            ++argv;
+            const std::string_view value = *argv ? *argv : "";
+            if (value == "idle") {
+                options.io_class = posix::IoClass::IDLE;
+            } else if (value == "best-effort") {
+                options.io_class = posix::IoClass::BEST_EFFORT;
+            } else if (value.size() == 13 && value.substr(0, 12) == "best-effort:" && value[12] >= '0' && value[12] <= '7') {
+                options.io_class = posix::IoClass::BEST_EFFORT;
+                options.io_level = value[12] - '0';
+            } else {
+                usage(program_name, error);
+                error << "\nerror: --ioprio requires \"idle\", \"best-effort\", or \"best-effort:LEVEL\" with LEVEL from 0 to 7.\n";
+                return 1;
+            }
+            options.set_io_priority = true;
+        } else if (arg == "--metrics") {
+            ++argv;
+            if (!*argv) {
+                usage(program_name, error);
+                error << "\nerror: --metrics requires a path argument.\n";
+                return 1;
+            }
+            const std::string_view value = *argv;
+            if (value.substr(0, 5) == "unix:") {
+                options.metrics.socket = value.substr(5);
+            } else {
+                options.metrics.path = value;
+            }
+        } else if (arg == "--metrics-interval") {
+            ++argv;
+            if (!*argv) {
+                usage(program_name, error);
+                error << "\nerror: --metrics-interval requires an integer argument.\n";
+                return 1;
+            }
+            long long value;
+            try {
+                value = std::stoll(*argv);
+            } catch (const std::exception&) {
+                usage(program_name, error);
+                error << "\nerror: \"" << *argv << "\" is not a valid integer argument for --metrics-interval\n";
+                return 1;
+            }
+            if (value < 1) {
+                usage(program_name, error);
+                error << "\nerror: --metrics-interval argument must be at least 1.\n";
+                return 1;
+            }
+            options.metrics.interval = std::chrono::milliseconds(value);
         } else if (arg.substr(0, 1) == "-") {
             usage(program_name, error);
             error << "\nerror: Unknown option \"" << arg << "\". If you meant a file name, use \"./" << arg << "\".\n";
@@ -71,11 +481,37 @@ int parse_command_line(Options& options, int argc, char* argv[], std::ostream& o
         }
     }
 
+    if (options.throttle.adaptive && !options.throttle.bytes_per_second) {
+        usage(program_name, error);
+        error << "\nerror: --adaptive requires --rate.\n";
+        return 1;
+    }
+
     if (!found_destination) {
         usage(program_name, error);
         error << "\nsource file and destination file arguments are required.\n";
         return 1;
     }
 
+    SocketAddress address;
+    if (options.receive && !parse_socket_address(options.source, address)) {
+        usage(program_name, error);
+        error << "\nerror: --receive requires an address, e.g. \"tcp::9000\" or \"unix:/tmp/copy.socket\".\n";
+        return 1;
+    }
+
+    if (options.cache_neutral && (options.receive || parse_socket_address(options.destination, address))) {
+        usage(program_name, error);
+        error << "\nerror: --cache-neutral requires a <destination file>, not an <address>.\n";
+        return 1;
+    }
+
+    // Only the file's contents cross a socket, so there's nothing to preserve.
+    if (options.preserve && (options.receive || parse_socket_address(options.destination, address))) {
+        usage(program_name, error);
+        error << "\nerror: --preserve requires a <destination file>, not an <address>.\n";
+        return 1;
+    }
+
     return 0;
 }
@@ -0,0 +1,345 @@
+#include "copyd.h"
+#include "metrics.h"
+#include "posix.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <signal.h>
+
+struct Options {
+    bool help = false;
+    std::string socket = copyd::default_socket_path;
+    std::size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    MetricsOptions metrics;
+    bool preserve = false;
+};
+
+void usage(std::string_view name, std::ostream& out);
+
+int parse_command_line(Options& options, int argc, char* argv[], std::ostream& out, std::ostream& error);
+
+// A client connection is shared by the thread that reads its requests, the
+// thread that writes its responses, and every worker that has a job from it.
+// The socket is closed when the last of them is done with it.
+//
+// Workers only queue responses. If they wrote to the socket themselves, then a
+// client that stopped reading would stall every worker in turn.
+class Connection {
+    int fd;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<copyd::Response> responses;
+    // how many requests have been read but not yet responded to
+    std::size_t pending = 0;
+    bool reading = true;
+    // whether the client can no longer be written to
+    bool broken = false;
+ public:
+    explicit Connection(int fd) : fd(fd) {}
+    ~Connection() {
+        posix::close_file(fd);
+    }
+
+    int socket() const {
+        return fd;
+    }
+
+    // Note that a request was read, so a response will follow.
+    void expect_response() {
+        std::lock_guard<std::mutex> lock{mutex};
+        ++pending;
+    }
+
+    // Note that no more requests will be read.
+    void stop_reading() {
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            reading = false;
+        }
+        changed.notify_one();
+    }
+
+    // Queue `response` to be sent to the client. This doesn't wait for the
+    // client.
+    void respond(const copyd::Response& response) {
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            --pending;
+            // If the client has gone away, then there's nobody to tell.
+            if (!broken) {
+                responses.push_back(response);
+            }
+        }
+        changed.notify_one();
+    }
+
+    // Send queued responses to the client until every request has been
+    // responded to and no more will be read, or until the client goes away.
+    void send_responses() {
+        std::unique_lock<std::mutex> lock{mutex};
+        for (;;) {
+            changed.wait(lock, [this]() { return !responses.empty() || (!reading && pending == 0); });
+            if (responses.empty()) {
+                return;
+            }
+            const copyd::Response response = responses.front();
+            responses.pop_front();
+            lock.unlock();
+            const int rc = posix::write_all(fd, reinterpret_cast<const char*>(&response), sizeof response);
+            lock.lock();
+            if (rc < 0) {
+                broken = true;
+                responses.clear();
+                return;
+            }
+        }
+    }
+};
+
+struct Job {
+    std::shared_ptr<Connection> connection;
+    std::uint64_t id;
+    std::string source;
+    std::string destination;
+};
+
+class JobQueue {
+    std::mutex mutex;
+    std::condition_variable not_empty;
+    std::deque<Job> jobs;
+    Metrics& metrics;
+ public:
+    explicit JobQueue(Metrics& metrics) : metrics(metrics) {}
+
+    void push(Job job) {
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            jobs.push_back(std::move(job));
+        }
+        metrics.add_queue_depth(1);
+        not_empty.notify_one();
+    }
+
+    Job pop() {
+        std::unique_lock<std::mutex> lock{mutex};
+        not_empty.wait(lock, [this]() { return !jobs.empty(); });
+        Job job = std::move(jobs.front());
+        jobs.pop_front();
+        metrics.add_queue_depth(-1);
+        return job;
+    }
+};
+
+// Read requests from `connection` and add them to `queue` until the client
+// disconnects or sends something malformed. Then tell `connection` that there
+// will be no more.
+void read_requests(std::shared_ptr<Connection> connection, JobQueue& queue);
+
+// Copy files on behalf of clients, forever, including their metadata if
+// `preserve`. Count them in `metrics`, if it's enabled.
+void work(JobQueue& queue, Metrics& metrics, bool preserve);
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (const int rc = parse_command_line(options, argc, argv, std::cout, std::cerr)) {
+        return rc;
+    } else if (options.help) {
+        return 0; // `parse_command_line` printed the usage already
+    }
+
+    // A client that disconnects before reading its responses must not kill
+    // the daemon. `write_all` will report `EPIPE` instead.
+    ::signal(SIGPIPE, SIG_IGN);
+
+    const int listener = posix::listen_on_unix_socket(options.socket.c_str());
+    if (listener < 0) {
+        std::cerr << "Unable to listen on \"" << options.socket << "\": " << std::strerror(-listener) << '\n';
+        return 1;
+    }
+
+    Metrics metrics{options.metrics};
+    if (const int rc = metrics.start()) {
+        std::cerr << "Unable to export metrics: " << std::strerror(rc) << '\n';
+        return 1;
+    }
+
+    JobQueue queue{metrics};
+    for (std::size_t i = 0; i < options.threads; ++i) {
+        std::thread(work, std::ref(queue), std::ref(metrics), options.preserve).detach();
+    }
+
+    for (;;) {
+        const int fd = posix::accept_connection(listener);
+        if (fd < 0) {
+            std::cerr << "Unable to accept a connection on \"" << options.socket << "\": " << std::strerror(-fd) << '\n';
+            continue;
+        }
+        const auto connection = std::make_shared<Connection>(fd);
+        std::thread(&Connection::send_responses, connection).detach();
+        std::thread(read_requests, connection, std::ref(queue)).detach();
+    }
+}
+
+void read_requests(std::shared_ptr<Connection> connection, JobQueue& queue) {
+    for (;;) {
+        copyd::Request request;
+        const int count = posix::read_all(connection->socket(), reinterpret_cast<char*>(&request), sizeof request);
+        if (count != sizeof request) {
+            break; // disconnected (or error)
+        }
+        if (request.source_length > copyd::max_path_length || request.destination_length > copyd::max_path_length) {
+            break;
+        }
+
+        Job job{.connection = connection, .id = request.id, .source = {}, .destination = {}};
+        job.source.resize(request.source_length);
+        job.destination.resize(request.destination_length);
+        if (posix::read_all(connection->socket(), job.source.data(), job.source.size()) != int(job.source.size()) ||
+            posix::read_all(connection->socket(), job.destination.data(), job.destination.size()) != int(job.destination.size())) {
+            break;
+        }
+        connection->expect_response();
+        queue.push(std::move(job));
+    }
+    connection->stop_reading();
+}
+
+void work(JobQueue& queue, Metrics& metrics, bool preserve) {
+    posix::CopyOptions copy_options;
+    copy_options.preserve = preserve;
+    ThreadCounters* counters = nullptr;
+    if (metrics.enabled()) {
+        counters = &metrics.thread_counters();
+        copy_options.chunk_size = 64 * 1024 * 1024;
+        copy_options.after_chunk = [counters](std::size_t count) {
+            counters->add(Counter::COPY_CALLS, 1);
+            counters->add(Counter::BYTES_COPIED, count);
+        };
+    }
+
+    for (;;) {
+        const Job job = queue.pop();
+        const int rc = posix::copy_all(job.source.c_str(), job.destination.c_str(), copy_options);
+        if (counters && rc == 0) {
+            counters->add(Counter::FILES_COPIED, 1);
+        }
+        job.connection->respond({.id = job.id, .error = rc, .reserved = 0});
+    }
+}
+
+void usage(std::string_view program_name, std::ostream& out) {
+    out << "usage:\n\n"
+        "    " << program_name << " [--help | -h] [--socket PATH] [--threads N]\n"
+        "        [--metrics DEST [--metrics-interval MILLIS]] [--preserve]\n\n"
+        "        --help or -h prints this message.\n"
+        "        PATH is the Unix domain socket on which to accept copy requests. It defaults to \"" << copyd::default_socket_path << "\".\n"
+        "            Only processes of the daemon's own user may connect to it.\n"
+        "        N is the number of threads that copy files. It defaults to the number of CPUs.\n"
+        "        --metrics exports live metrics in the OpenMetrics text format to DEST, which is either a file,\n"
+        "            replaced every MILLIS milliseconds (default 1000), or \"unix:PATH\", a Unix\n"
+        "            domain socket that sends the metrics to each client that connects.\n"
+        "        --preserve copies each file's extended attributes (including ACLs), ownership, permissions,\n"
+        "            and timestamps too. It's always on for Darwin.\n"
+        "\n"
+        "    Copy files on behalf of clients, such as copy-client, until killed.\n";
+}
+
+int parse_command_line(Options& options, int argc, char* argv[], std::ostream& out, std::ostream& error) {
+    const std::string_view program_name =  argv[0];
+    if (argc > 1 + 2 + 2 + 2 + 2 + 1) {
+        usage(program_name, error);
+        return 1;
+    }
+
+    for (++argv; *argv; ++argv) {
+        const std::string_view arg = *argv;
+        if (arg == "--help" || arg == "-h") {
+            options.help = true;
+            usage(program_name, out);
+            return 0;
+        } else if (arg == "--socket") {
+            ++argv;
+            if (!*argv) {
+                usage(program_name, error);
+                error << "\nerror: --socket requires a path argument.\n";
+                return 1;
+            }
+            options.socket = *argv;
+        } else if (arg == "--threads") {
+            ++argv;
+            if (!*argv) {
+                usage(program_name, error);
+                error << "\nerror: --threads requires an integer argument.\n";
+                return 1;
+            }
+            long long value;
+            try {
+                value = std::stoll(*argv);
+            } catch (const std::exception&) {
+                usage(program_name, error);
+                error << "\nerror: \"" << *argv << "\" is not a valid integer argument for --threads\n";
+                return 1;
+            }
+            if (value < 1) {
+                usage(program_name, error);
+                error << "\nerror: --threads argument must be at least 1.\n";
+                return 1;
+            }
+            options.threads = value;
+        } else if (arg == "--preserve") {
+            options.preserve = true;
+        } else if (arg == "--metrics") {
+            ++argv;
+            if (!*argv) {
+                usage(program_name, error);
+                error << "\nerror: --metrics requires a path argument.\n";
+                return 1;
+            }
+            const std::string_view value = *argv;
+            if (value.substr(0, 5) == "unix:") {
+                options.metrics.socket = value.substr(5);
+            } else {
+                options.metrics.path = value;
+            }
+        } else if (arg == "--metrics-interval") {
+            ++argv;
+            if (!*argv) {
+                usage(program_name, error);
+                error << "\nerror: --metrics-interval requires an integer argument.\n";
+                return 1;
+            }
+            long long value;
+            try {
+                value = std::stoll(*argv);
+            } catch (const std::exception&) {
+                usage(program_name, error);
+                error << "\nerror: \"" << *argv << "\" is not a valid integer argument for --metrics-interval\n";
+                return 1;
+            }
+            if (value < 1) {
+                usage(program_name, error);
+                error << "\nerror: --metrics-interval argument must be at least 1.\n";
+                return 1;
+            }
+            options.metrics.interval = std::chrono::milliseconds(value);
+        } else {
+            usage(program_name, error);
+            error << "\nerror: Unknown argument \"" << arg << "\".\n";
+            return 1;
+        }
+    }
+
+    return 0;
+}
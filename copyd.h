@@ -0,0 +1,41 @@
+#pragma once
+
+// This is the protocol spoken between `copyd` and `copy-client` over a Unix
+// domain stream socket. Both ends are on the same machine, so integers are in
+// the host's byte order.
+//
+// The client sends any number of requests, each a `Request` followed by the
+// bytes of the source path and then the bytes of the destination path (no
+// null terminators). Paths are absolute, because the daemon's working
+// directory is not the client's.
+//
+// For each request, the daemon eventually sends a `Response` having the
+// request's `id`. Requests are handled concurrently, so responses can arrive
+// in any order.
+
+#include <cstdint>
+
+namespace copyd {
+
+struct Request {
+    std::uint64_t id;
+    std::uint32_t source_length;
+    std::uint32_t destination_length;
+};
+
+struct Response {
+    std::uint64_t id;
+    // zero on success, or an `errno` value from `posix::copy_all`
+    std::int32_t error;
+    std::uint32_t reserved;
+};
+
+// Paths longer than this are rejected by the daemon, so that a corrupt
+// request can't make it allocate without bound.
+const std::uint32_t max_path_length = 4096;
+
+// The path at which the daemon listens and the client connects, unless
+// overridden by `--socket`.
+inline const char default_socket_path[] = "/tmp/copyd.socket";
+
+} // namespace copyd
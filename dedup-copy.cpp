@@ -0,0 +1,434 @@
+#include "checksum.h"
+#include "posix.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+
+enum class Method {
+    // Duplicates become hard links to one copy.
+    HARD_LINK,
+    // Duplicates are separate files that share one copy's data.
+    REFLINK,
+    // Every file is copied, as without deduplication, for comparison.
+    NONE
+};
+
+struct Options {
+    bool help = false;
+    Method method = Method::HARD_LINK;
+    std::size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    std::string source;
+    std::string destination;
+};
+
+// Files whose first this many bytes differ are told apart without reading the
+// rest.
+constexpr std::size_t first_block_size = 64 * 1024;
+
+// Files are read this many bytes at a time.
+constexpr std::size_t chunk_size = 1024 * 1024;
+
+struct File {
+    std::string name;
+    posix::FileStatus status;
+    // CRC-32C of the bytes hashed so far: the first block, then the whole file
+    std::uint32_t crc;
+    // whether the file might still be a duplicate, i.e. whether it has been
+    // hashed without error
+    bool candidate;
+    // index of the file whose copy this file's destination shares, or this
+    // file's own index if it is copied
+    std::size_t original;
+    // `errno` value of the failed copy, or zero
+    int error;
+};
+
+// indices of files that might have the same contents
+using Group = std::vector<std::size_t>;
+
+void usage(std::string_view name, std::ostream& out);
+
+int parse_command_line(Options& options, int argc, char* argv[], std::ostream& out, std::ostream& error);
+
+// Call `work(i)` for each `i` from zero up to but not including `count`, using
+// up to `threads` threads.
+template <typename Work>
+void in_parallel(std::size_t count, std::size_t threads, const Work& work) {
+    std::atomic<std::size_t> next = 0;
+    std::vector<std::thread> pool;
+    for (std::size_t i = 0; i < std::min(threads, count); ++i) {
+        pool.emplace_back([&]() {
+            for (std::size_t task; (task = next++) < count;) {
+                work(task);
+            }
+        });
+    }
+    for (std::thread& thread : pool) {
+        thread.join();
+    }
+}
+
+// Split each of `groups` into groups of `files` that have the same `key`, and
+// return those that have more than one file. Files that are no longer
+// candidates are dropped.
+template <typename Key>
+std::vector<Group> split(const std::vector<File>& files, std::vector<Group> groups, const Key& key) {
+    std::vector<Group> result;
+    for (Group& group : groups) {
+        std::erase_if(group, [&](std::size_t i) { return !files[i].candidate; });
+        std::stable_sort(group.begin(), group.end(), [&](std::size_t left, std::size_t right) {
+            return key(files[left]) < key(files[right]);
+        });
+        for (auto begin = group.begin(); begin != group.end();) {
+            const auto end = std::find_if(begin, group.end(), [&](std::size_t i) {
+                return key(files[i]) != key(files[*begin]);
+            });
+            if (end - begin > 1) {
+                result.emplace_back(begin, end);
+            }
+            begin = end;
+        }
+    }
+    return result;
+}
+
+// Continue the CRC-32C `crc` over the bytes of the file at `path` from `begin`
+// up to but not including `end`. Return zero on success, or return `errno` if
+// an error occurs.
+int hash_file(const std::string& path, std::size_t begin, std::size_t end, std::uint32_t& crc);
+
+// Return whether the files at `left_path` and `right_path` both consist of the
+// same `size` bytes. Files that can't be read are considered different.
+bool same_contents(const std::string& left_path, const std::string& right_path, std::size_t size);
+
+// Copy the file at `source` to `destination`, replacing `destination` rather
+// than writing through it, since it might be a hard link left by an earlier
+// run. Return zero on success, or return `errno` if an error occurs.
+int copy_file(const std::string& source, const std::string& destination);
+
+// Make `destination` have the contents of `copy` using `method`, where `copy`
+// was copied from a file with the same contents as `source`, whose status is
+// `status`. If the file system can't do that, copy `source` instead. Return
+// zero on success, or return `errno` if an error occurs.
+int duplicate(Method method, const std::string& copy, const std::string& source, const posix::FileStatus& status, const std::string& destination);
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (const int rc = parse_command_line(options, argc, argv, std::cout, std::cerr)) {
+        return rc;
+    } else if (options.help) {
+        return 0; // `parse_command_line` printed the usage already
+    }
+
+    std::vector<std::string> names;
+    if (const int rc = posix::list_directory(options.source.c_str(), names)) {
+        std::cerr << "Unable to list the contents of \"" << options.source << "\": " << std::strerror(rc) << '\n';
+        return 1;
+    }
+
+    std::vector<posix::FileStatusResult> statuses(names.size());
+    in_parallel(names.size(), options.threads, [&](std::size_t i) {
+        const std::string path = options.source + '/' + names[i];
+        const int fd = posix::open_for_reading(path.c_str());
+        if (fd < 0) {
+            statuses[i].error = -fd;
+            return;
+        }
+        statuses[i] = posix::file_status(fd);
+        posix::close_file(fd);
+    });
+
+    int status = 0;
+    std::vector<File> files;
+    for (std::size_t i = 0; i < names.size(); ++i) {
+        if (statuses[i].error) {
+            std::cerr << "Unable to read the status of \"" << options.source << '/' << names[i] << "\": " << std::strerror(statuses[i].error) << '\n';
+            status = 1;
+        } else if (S_ISREG(statuses[i].status.mode)) { // subdirectories and special files are not copied
+            files.push_back({.name = std::move(names[i]), .status = statuses[i].status, .crc = 0, .candidate = true, .original = files.size(), .error = 0});
+        }
+    }
+
+    const auto source_path = [&](const File& file) {
+        return options.source + '/' + file.name;
+    };
+    const auto destination_path = [&](const File& file) {
+        return options.destination + '/' + file.name;
+    };
+
+    if (options.method != Method::NONE) {
+        // Find duplicates in stages that each read more of fewer files: files
+        // of the same size, then with the same CRC of their first block, then
+        // with the same CRC of their whole contents. Hard links share their
+        // permissions, too, so only files with the same mode are linked.
+        Group all(files.size());
+        for (std::size_t i = 0; i < files.size(); ++i) {
+            all[i] = i;
+        }
+        std::vector<Group> groups = split(files, {all}, [&](const File& file) {
+            return std::pair(file.status.size, options.method == Method::HARD_LINK ? file.status.mode : 0);
+        });
+
+        // Hash the files in `groups` either up to the end of their first
+        // block, or from there to their end. Then split the groups by CRC.
+        const auto hash = [&](bool rest) {
+            Group candidates;
+            for (const Group& group : groups) {
+                candidates.insert(candidates.end(), group.begin(), group.end());
+            }
+            in_parallel(candidates.size(), options.threads, [&](std::size_t i) {
+                File& file = files[candidates[i]];
+                const std::size_t first_end = std::min(file.status.size, first_block_size);
+                const std::size_t begin = rest ? first_end : 0;
+                const std::size_t end = rest ? file.status.size : first_end;
+                if (hash_file(source_path(file), begin, end, file.crc)) {
+                    file.candidate = false; // copying it will report the error
+                }
+            });
+            groups = split(files, std::move(groups), [](const File& file) { return file.crc; });
+        };
+
+        hash(false);
+        // Files no larger than one block are already hashed whole.
+        std::vector<Group> hashed;
+        std::erase_if(groups, [&](Group& group) {
+            if (files[group[0]].status.size > first_block_size) {
+                return false;
+            }
+            hashed.push_back(std::move(group));
+            return true;
+        });
+        hash(true);
+        groups.insert(groups.end(), hashed.begin(), hashed.end());
+
+        // Don't trust a CRC: compare the bytes. Each file is a duplicate of
+        // the first earlier file in its group that has the same contents, if
+        // any.
+        in_parallel(groups.size(), options.threads, [&](std::size_t g) {
+            Group originals;
+            for (const std::size_t i : groups[g]) {
+                File& file = files[i];
+                for (const std::size_t original : originals) {
+                    if (same_contents(source_path(files[original]), source_path(file), file.status.size)) {
+                        file.original = original;
+                        break;
+                    }
+                }
+                if (file.original == i) {
+                    originals.push_back(i);
+                }
+            }
+        });
+    }
+
+    // Copy each distinct file, and then make the duplicates from the copies.
+    Group originals;
+    Group duplicates;
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        (files[i].original == i ? originals : duplicates).push_back(i);
+    }
+    in_parallel(originals.size(), options.threads, [&](std::size_t i) {
+        File& file = files[originals[i]];
+        file.error = copy_file(source_path(file), destination_path(file));
+    });
+    in_parallel(duplicates.size(), options.threads, [&](std::size_t i) {
+        File& file = files[duplicates[i]];
+        const File& original = files[file.original];
+        if (original.error) {
+            file.error = copy_file(source_path(file), destination_path(file));
+        } else {
+            file.error = duplicate(options.method, destination_path(original), source_path(file), file.status, destination_path(file));
+        }
+    });
+
+    for (const File& file : files) {
+        if (file.error) {
+            std::cerr << "Unable to copy \"" << source_path(file) << "\" to \"" << destination_path(file) << "\": " << std::strerror(file.error) << '\n';
+            status = 1;
+        }
+    }
+    return status;
+}
+
+int hash_file(const std::string& path, std::size_t begin, std::size_t end, std::uint32_t& crc) {
+    const int fd = posix::open_for_reading(path.c_str());
+    if (fd < 0) {
+        return -fd;
+    }
+    thread_local std::vector<char> buffer(chunk_size);
+    int rc = posix::seek(fd, begin);
+    for (std::size_t offset = begin; !rc && offset < end;) {
+        const std::size_t count = std::min(chunk_size, end - offset);
+        const int received = posix::read_all(fd, buffer.data(), count);
+        if (received < 0) {
+            rc = -received;
+        } else if (std::size_t(received) < count) {
+            rc = EIO; // the file got shorter since we looked
+        } else {
+            crc = checksum::crc32c(buffer.data(), count, crc);
+            offset += count;
+        }
+    }
+    posix::close_file(fd);
+    return rc;
+}
+
+bool same_contents(const std::string& left_path, const std::string& right_path, std::size_t size) {
+    const int left = posix::open_for_reading(left_path.c_str());
+    if (left < 0) {
+        return false;
+    }
+    const int right = posix::open_for_reading(right_path.c_str());
+    if (right < 0) {
+        posix::close_file(left);
+        return false;
+    }
+    thread_local std::vector<char> left_buffer(chunk_size);
+    thread_local std::vector<char> right_buffer(chunk_size);
+    bool same = true;
+    for (std::size_t offset = 0; same && offset < size;) {
+        const std::size_t count = std::min(chunk_size, size - offset);
+        same = posix::read_all(left, left_buffer.data(), count) == int(count) &&
+               posix::read_all(right, right_buffer.data(), count) == int(count) &&
+               std::memcmp(left_buffer.data(), right_buffer.data(), count) == 0;
+        offset += count;
+    }
+    posix::close_file(left);
+    posix::close_file(right);
+    return same;
+}
+
+int copy_file(const std::string& source, const std::string& destination) {
+    if (const int rc = posix::remove_file(destination.c_str()); rc && rc != ENOENT) {
+        return rc;
+    }
+    return posix::copy_all(source.c_str(), destination.c_str());
+}
+
+int duplicate(Method method, const std::string& copy, const std::string& source, const posix::FileStatus& status, const std::string& destination) {
+    if (const int rc = posix::remove_file(destination.c_str()); rc && rc != ENOENT) {
+        return rc;
+    }
+
+    if (method == Method::HARD_LINK) {
+        const int rc = posix::link_file(copy.c_str(), destination.c_str());
+        // A file can have only so many links.
+        return rc == EMLINK ? posix::copy_all(source.c_str(), destination.c_str()) : rc;
+    }
+
+    const int copy_fd = posix::open_for_reading(copy.c_str());
+    if (copy_fd < 0) {
+        return -copy_fd;
+    }
+    const int destination_fd = posix::open_for_writing(destination.c_str(), status.mode);
+    if (destination_fd < 0) {
+        posix::close_file(copy_fd);
+        return -destination_fd;
+    }
+    const int rc = posix::clone_file(copy_fd, destination_fd);
+    posix::close_file(copy_fd);
+    posix::close_file(destination_fd);
+    if (rc == EOPNOTSUPP || rc == ENOTSUP || rc == EXDEV || rc == EINVAL) {
+        return posix::copy_all(source.c_str(), destination.c_str());
+    }
+    return rc;
+}
+
+void usage(std::string_view program_name, std::ostream& out) {
+    out << "usage:\n\n"
+        "    " << program_name << " [--help | -h] [--threads COUNT] [--reflink | --no-dedup] <source directory> <destination directory>\n\n"
+        "        --help or -h prints this message.\n"
+        "        COUNT is the number of threads that hash and copy files. The default is the number of CPUs.\n"
+        "        Files with the same contents are copied once. By default, the other destination files are\n"
+        "            hard links to that copy, so changing one changes them all. Only files with the same\n"
+        "            permissions are linked.\n"
+        "        --reflink makes the other destination files separate files that share the copy's data\n"
+        "            until one is modified (FICLONE), on file systems that can. Elsewhere, they're copied.\n"
+        "        --no-dedup copies every file, without looking for duplicates, for comparison.\n"
+        "        <source directory> contains the regular files to copy. Subdirectories are not copied.\n"
+        "        <destination directory> is the existing directory into which the files are copied.\n";
+}
+
+int parse_command_line(Options& options, int argc, char* argv[], std::ostream& out, std::ostream& error) {
+    const std::string_view program_name =  argv[0];
+    if (argc < 1 + 1 || argc > 1 + 2 + 1 + 2) {
+        usage(program_name, error);
+        return 1;
+    }
+
+    bool found_source = false;
+    bool found_destination = false;
+    bool found_method = false;
+
+    for (++argv; *argv; ++argv) {
+        const std::string_view arg = *argv;
+        if (arg == "--help" || arg == "-h") {
+            options.help = true;
+            usage(program_name, out);
+            return 0;
+        } else if (arg == "--reflink" || arg == "--no-dedup") {
+            if (found_method) {
+                usage(program_name, error);
+                error << "\nerror: --reflink and --no-dedup can't be combined.\n";
+                return 1;
+            }
+            options.method = arg == "--reflink" ? Method::REFLINK : Method::NONE;
+            found_method = true;
+        } else if (arg == "--threads") {
+            ++argv;
+            if (!*argv) {
+                usage(program_name, error);
+                error << "\nerror: " << arg << " requires an integer argument.\n";
+                return 1;
+            }
+            long long value;
+            try {
+                value = std::stoll(*argv);
+            } catch (const std::exception&) {
+                usage(program_name, error);
+                error << "\nerror: \"" << *argv << "\" is not a valid integer argument for " << arg << '\n';
+                return 1;
+            }
+            if (value < 1) {
+                usage(program_name, error);
+                error << "\nerror: --threads argument must be at least 1.\n";
+                return 1;
+            }
+            options.threads = value;
+        } else if (arg.substr(0, 1) == "-") {
+            usage(program_name, error);
+            error << "\nerror: Unknown option \"" << arg << "\". If you meant a directory name, use \"./" << arg << "\".\n";
+            return 1;
+        } else if (found_source && found_destination) {
+            usage(program_name, error);
+            return 1;
+        } else if (found_source) {
+            options.destination = arg;
+            found_destination = true;
+        } else {
+            options.source = arg;
+            found_source = true;
+        }
+    }
+
+    if (!found_destination) {
+        usage(program_name, error);
+        error << "\nsource directory and destination directory arguments are required.\n";
+        return 1;
+    }
+
+    return 0;
+}
@@ -1,3 +1,6 @@
+# Plot only the runs of one scenario, e.g. `gnuplot -e "scenario='warm'"`.
+if (!exists('scenario')) scenario = 'cold'
+
 set pointsize 2
 
 set logscale y 10
@@ -10,11 +13,12 @@ set key outside
 
 set xlabel 'file size (bytes)'
 set ylabel 'wall time (milliseconds)'
-set title 'Copy: Wall Time Versus File Size'
+set title sprintf('Copy: Wall Time Versus File Size (%s)', scenario)
 
-plot '../var/wall-stats.dat' using ((strcol(1) eq 'read-write') ? $2 : NaN):($3/1000):($4/1000) with errorbars title 'read-write', \
-     '' using ((strcol(1) eq 'mmap-mmap') ? $2*1.1 : NaN):($3/1000):($4/1000) with errorbars title 'mmap-mmap', \
-     '' using ((strcol(1) eq 'mmap-write') ? $2*1.2 : NaN):($3/1000):($4/1000) with errorbars title 'mmap-write', \
-     '' using ((strcol(1) eq 'read-mmap') ? $2*1.3 : NaN):($3/1000):($4/1000) with errorbars title 'read-mmap', \
-     '' using ((strcol(1) eq 'copy') ? $2*1.4 : NaN):($3/1000):($4/1000) with errorbars title 'copy', \
-     '' using ((strcol(1) eq '/usr/bin/cp') ? $2*1.5 : NaN):($3/1000):($4/1000) with errorbars title '/usr/bin/cp'
+plot '../var/wall-stats.dat' using ((strcol(1) eq 'read-write' && strcol(5) eq scenario) ? $2 : NaN):($3/1000):($4/1000) with errorbars title 'read-write', \
+     '' using ((strcol(1) eq 'mmap-mmap' && strcol(5) eq scenario) ? $2*1.1 : NaN):($3/1000):($4/1000) with errorbars title 'mmap-mmap', \
+     '' using ((strcol(1) eq 'mmap-write' && strcol(5) eq scenario) ? $2*1.2 : NaN):($3/1000):($4/1000) with errorbars title 'mmap-write', \
+     '' using ((strcol(1) eq 'read-mmap' && strcol(5) eq scenario) ? $2*1.3 : NaN):($3/1000):($4/1000) with errorbars title 'read-mmap', \
+     '' using ((strcol(1) eq 'mmap-threads' && strcol(5) eq scenario) ? $2*1.4 : NaN):($3/1000):($4/1000) with errorbars title 'mmap-threads', \
+     '' using ((strcol(1) eq 'copy' && strcol(5) eq scenario) ? $2*1.5 : NaN):($3/1000):($4/1000) with errorbars title 'copy', \
+     '' using ((strcol(1) eq '/usr/bin/cp' && strcol(5) eq scenario) ? $2*1.6 : NaN):($3/1000):($4/1000) with errorbars title '/usr/bin/cp'
@@ -1,5 +1,5 @@
 .load ../../sqlean/dist/sqlean.so
 .mode tabs
 .output ../var/wall-stats.dat
-select tool, file_size, avg(wall_micros), stats_stddev_samp(wall_micros) from CopyRun group by tool, file_size;
+select tool, file_size, avg(wall_micros), stats_stddev_samp(wall_micros), scenario from CopyRun group by tool, file_size, scenario;
 .output
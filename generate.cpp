@@ -0,0 +1,343 @@
+#include "posix.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+struct Options {
+    bool help = false;
+    std::size_t size = 0;
+    std::string path;
+    std::uint64_t seed = 0;
+    std::size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    // percentage of each page that repeats earlier bytes of the page
+    int compressibility = 0;
+    // percentage of blocks left unwritten, as holes
+    int holes = 0;
+    // zero means that `path` is a file, rather than a directory of files
+    std::size_t files = 0;
+    // If not zero, file number N has the same contents as file number
+    // N % `distinct`, so that there are only this many distinct files.
+    std::size_t distinct = 0;
+};
+
+// Files are generated in blocks of this many bytes. Each block is either data
+// or a hole, and its data depends only on the seed, the file, and the block's
+// position in the file, so that the output doesn't depend on the number of
+// threads.
+constexpr std::size_t block_size = 64 * 1024;
+
+// Compressibility applies to each piece of a block of this many bytes, so that
+// a compressor with a small window still finds the repetition.
+constexpr std::size_t piece_size = 4096;
+
+// Blocks of a single file are handed out to threads this many at a time.
+constexpr std::size_t blocks_per_task = 16;
+
+void usage(std::string_view name, std::ostream& out);
+
+int parse_command_line(Options& options, int argc, char* argv[], std::ostream& out, std::ostream& error);
+
+// Parse `text` as a size in bytes, such as "4096", "64K", or "1Gx2" (meaning 2
+// GiB). Return whether `text` is valid.
+bool parse_size(std::string_view text, std::size_t& size);
+
+// Return the next value of the "splitmix64" pseudo-random sequence whose state
+// is `state`.
+std::uint64_t next_random(std::uint64_t& state);
+
+// Fill the `count` bytes at `destination` with the data of the block whose
+// random sequence begins at `state`.
+void fill_block(char* destination, std::size_t count, std::uint64_t state, int compressibility);
+
+// Write the blocks of file number `file` from `first_block` up to but not
+// including `end_block` to `fd`, where the file is `size` bytes long. Use
+// `buffer`, which is at least `block_size` bytes. Return zero on success, or
+// return `errno` if an error occurs.
+int generate_blocks(int fd, const Options& options, std::size_t file, std::size_t first_block, std::size_t end_block, char* buffer);
+
+// Create the file at `path` and write file number `file` to it. Return zero on
+// success, or return `errno` if an error occurs.
+int generate_file(const std::string& path, const Options& options, std::size_t file, char* buffer);
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (const int rc = parse_command_line(options, argc, argv, std::cout, std::cerr)) {
+        return rc;
+    } else if (options.help) {
+        return 0; // `parse_command_line` printed the usage already
+    }
+
+    // Threads take work from `next_task` until there's none left or one of
+    // them fails.
+    std::atomic<std::size_t> next_task = 0;
+    std::atomic<int> error = 0;
+    std::atomic<std::size_t> failed_file = 0;
+    std::vector<std::thread> threads;
+
+    if (options.files == 0) {
+        const int fd = posix::open_for_writing(options.path.c_str(), 0644);
+        if (fd < 0) {
+            std::cerr << "Unable to open \"" << options.path << "\" for writing: " << std::strerror(-fd) << '\n';
+            return 1;
+        }
+        // Setting the size first leaves holes wherever no block is written.
+        if (const int rc = posix::truncate_file(fd, options.size)) {
+            std::cerr << "Unable to resize \"" << options.path << "\": " << std::strerror(rc) << '\n';
+            posix::close_file(fd);
+            return 1;
+        }
+        const std::size_t num_blocks = (options.size + block_size - 1) / block_size;
+        const std::size_t num_tasks = (num_blocks + blocks_per_task - 1) / blocks_per_task;
+        for (std::size_t i = 0; i < std::min(options.threads, num_tasks); ++i) {
+            threads.emplace_back([&]() {
+                const std::unique_ptr<char[]> buffer{new char[block_size]};
+                for (std::size_t task; !error && (task = next_task++) < num_tasks;) {
+                    const std::size_t first_block = task * blocks_per_task;
+                    const std::size_t end_block = std::min(first_block + blocks_per_task, num_blocks);
+                    if (const int rc = generate_blocks(fd, options, 0, first_block, end_block, buffer.get())) {
+                        error = rc;
+                    }
+                }
+            });
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        posix::close_file(fd);
+        if (error) {
+            std::cerr << "Unable to write to \"" << options.path << "\": " << std::strerror(error) << '\n';
+            return 1;
+        }
+        return 0;
+    }
+
+    for (std::size_t i = 0; i < std::min(options.threads, options.files); ++i) {
+        threads.emplace_back([&]() {
+            const std::unique_ptr<char[]> buffer{new char[block_size]};
+            for (std::size_t file; !error && (file = next_task++) < options.files;) {
+                const std::string path = options.path + '/' + std::to_string(file);
+                const std::size_t contents = options.distinct ? file % options.distinct : file;
+                if (const int rc = generate_file(path, options, contents, buffer.get())) {
+                    failed_file = file;
+                    error = rc;
+                }
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    if (error) {
+        std::cerr << "Unable to generate \"" << options.path << '/' << failed_file << "\": " << std::strerror(error) << '\n';
+        return 1;
+    }
+}
+
+std::uint64_t next_random(std::uint64_t& state) {
+    std::uint64_t z = (state += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+void fill_block(char* destination, std::size_t count, std::uint64_t state, int compressibility) {
+    for (std::size_t offset = 0; offset < count; offset += piece_size) {
+        char* const piece = destination + offset;
+        const std::size_t length = std::min(piece_size, count - offset);
+        // Round to whole random words, but always have at least one, so that
+        // no page is all zeros.
+        const std::size_t random = std::max<std::size_t>(8, length * (100 - compressibility) / 100 / 8 * 8);
+        for (std::size_t i = 0; i < random && i < length; i += 8) {
+            const std::uint64_t word = next_random(state);
+            std::memcpy(piece + i, &word, std::min<std::size_t>(8, length - i));
+        }
+        // The rest of the piece repeats its random beginning.
+        for (std::size_t i = random; i < length; i += random) {
+            std::memcpy(piece + i, piece, std::min(random, length - i));
+        }
+    }
+}
+
+int generate_blocks(int fd, const Options& options, std::size_t file, std::size_t first_block, std::size_t end_block, char* buffer) {
+    for (std::size_t block = first_block; block < end_block; ++block) {
+        std::uint64_t state = options.seed;
+        state ^= next_random(state) + file;
+        state ^= next_random(state) + block;
+        next_random(state);
+        if (options.holes && next_random(state) % 100 < std::uint64_t(options.holes)) {
+            continue;
+        }
+        const std::size_t offset = block * block_size;
+        const std::size_t count = std::min(block_size, options.size - offset);
+        fill_block(buffer, count, state, options.compressibility);
+        const int rc = posix::write_all_at(fd, buffer, count, offset);
+        if (rc < 0) {
+            return -rc;
+        }
+    }
+    return 0;
+}
+
+int generate_file(const std::string& path, const Options& options, std::size_t file, char* buffer) {
+    const int fd = posix::open_for_writing(path.c_str(), 0644);
+    if (fd < 0) {
+        return -fd;
+    }
+    int rc = posix::truncate_file(fd, options.size);
+    if (!rc) {
+        rc = generate_blocks(fd, options, file, 0, (options.size + block_size - 1) / block_size, buffer);
+    }
+    posix::close_file(fd);
+    return rc;
+}
+
+bool parse_size(std::string_view text, std::size_t& size) {
+    const std::size_t times = text.find('x');
+    std::size_t count = 1;
+    if (times != std::string_view::npos) {
+        if (!parse_size(text.substr(times + 1), count)) {
+            return false;
+        }
+        text = text.substr(0, times);
+    }
+    std::size_t unit = 1;
+    if (!text.empty()) {
+        switch (text.back()) {
+            case 'K': unit = std::size_t(1) << 10; break;
+            case 'M': unit = std::size_t(1) << 20; break;
+            case 'G': unit = std::size_t(1) << 30; break;
+            case 'T': unit = std::size_t(1) << 40; break;
+        }
+        if (unit != 1) {
+            text.remove_suffix(1);
+        }
+    }
+    if (text.empty() || text.find_first_not_of("0123456789") != std::string_view::npos) {
+        return false;
+    }
+    long long value;
+    try {
+        value = std::stoll(std::string(text));
+    } catch (const std::exception&) {
+        return false;
+    }
+    size = std::size_t(value) * unit * count;
+    return true;
+}
+
+void usage(std::string_view program_name, std::ostream& out) {
+    out << "usage:\n\n"
+        "    " << program_name << " [--help | -h] [--seed SEED] [--threads COUNT] [--compressibility PERCENT]\n"
+        "        [--holes PERCENT] [--files COUNT [--distinct COUNT]] <size> <path>\n\n"
+        "        --help or -h prints this message.\n"
+        "        SEED determines the pseudo-random data. The same arguments always produce the same files.\n"
+        "            The default is 0.\n"
+        "        --threads is the number of threads that write. The default is the number of CPUs.\n"
+        "        --compressibility is the percentage of each 4 KiB page that repeats the rest of the page.\n"
+        "            The default is 0 (incompressible).\n"
+        "        --holes is the percentage of 64 KiB blocks left as holes. The default is 0.\n"
+        "        --files makes <path> an existing directory in which to create files named 0, 1, 2, etc.\n"
+        "            Without it, <path> is the file to create.\n"
+        "        --distinct is the number of different files among those made by --files. The rest repeat\n"
+        "            them, e.g. with --distinct 10, file 12 is the same as file 2. The default is every file\n"
+        "            is different.\n"
+        "        <size> is the size of each file in bytes, optionally followed by K, M, G, or T (powers of\n"
+        "            1024) and then by \"xCOUNT\" to multiply, e.g. \"1Gx2\".\n"
+        "        <path> is where to write, see --files.\n";
+}
+
+int parse_command_line(Options& options, int argc, char* argv[], std::ostream& out, std::ostream& error) {
+    const std::string_view program_name =  argv[0];
+    if (argc < 1 + 1 || argc > 1 + 2 + 2 + 2 + 2 + 2 + 2 + 2) {
+        usage(program_name, error);
+        return 1;
+    }
+
+    bool found_size = false;
+    bool found_path = false;
+
+    for (++argv; *argv; ++argv) {
+        const std::string_view arg = *argv;
+        if (arg == "--help" || arg == "-h") {
+            options.help = true;
+            usage(program_name, out);
+            return 0;
+        } else if (arg == "--seed" || arg == "--threads" || arg == "--compressibility" || arg == "--holes" || arg == "--files" || arg == "--distinct") {
+            ++argv;
+            if (!*argv) {
+                usage(program_name, error);
+                error << "\nerror: " << arg << " requires an integer argument.\n";
+                return 1;
+            }
+            long long value;
+            try {
+                value = std::stoll(*argv);
+            } catch (const std::exception&) {
+                usage(program_name, error);
+                error << "\nerror: \"" << *argv << "\" is not a valid integer argument for " << arg << '\n';
+                return 1;
+            }
+            const bool is_percent = arg == "--compressibility" || arg == "--holes";
+            const long long least = (arg == "--threads" || arg == "--files" || arg == "--distinct") ? 1 : 0;
+            if (value < least || (is_percent && value > 100)) {
+                usage(program_name, error);
+                error << "\nerror: " << arg << " argument must be at least " << least << (is_percent ? " and at most 100" : "") << ".\n";
+                return 1;
+            }
+            if (arg == "--seed") {
+                options.seed = value;
+            } else if (arg == "--threads") {
+                options.threads = value;
+            } else if (arg == "--compressibility") {
+                options.compressibility = value;
+            } else if (arg == "--holes") {
+                options.holes = value;
+            } else if (arg == "--files") {
+                options.files = value;
+            } else {
+                options.distinct = value;
+            }
+        } else if (arg.substr(0, 1) == "-") {
+            usage(program_name, error);
+            error << "\nerror: Unknown option \"" << arg << "\". If you meant a file name, use \"./" << arg << "\".\n";
+            return 1;
+        } else if (found_size && found_path) {
+            usage(program_name, error);
+            return 1;
+        } else if (found_size) {
+            options.path = arg;
+            found_path = true;
+        } else {
+            if (!parse_size(arg, options.size)) {
+                usage(program_name, error);
+                error << "\nerror: \"" << arg << "\" is not a valid size.\n";
+                return 1;
+            }
+            found_size = true;
+        }
+    }
+
+    if (!found_path) {
+        usage(program_name, error);
+        error << "\nsize and path arguments are required.\n";
+        return 1;
+    }
+
+    if (options.distinct && !options.files) {
+        usage(program_name, error);
+        error << "\nerror: --distinct requires --files.\n";
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,127 @@
+#include "journal.h"
+
+#include "checksum.h"
+#include "posix.h"
+
+#include <cerrno>
+#include <fstream>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+namespace {
+
+struct Chunk {
+    std::size_t offset;
+    std::size_t length;
+    std::uint32_t checksum;
+};
+
+// Parse the journal at `path`. If it has the expected `header`, then store the
+// chunks that continue one another from offset zero into `chunks`, and the
+// size in bytes of the journal up to the end of the last such chunk into
+// `valid_size`, and return `true`. Otherwise, return `false`.
+bool parse(const std::string& path, const JournalHeader& header, std::vector<Chunk>& chunks, std::size_t& valid_size) {
+    std::ifstream in{path};
+    std::string line;
+    std::size_t source_size;
+    std::int64_t source_modified;
+    if (!std::getline(in, line) || line != "copy-journal 1" ||
+        !(in >> line >> source_size) || line != "source-size" || source_size != header.source_size ||
+        !(in >> line >> source_modified) || line != "source-modified" || source_modified != header.source_modified ||
+        !std::getline(in, line) || !line.empty()) {
+        return false;
+    }
+
+    valid_size = in.tellg();
+    std::size_t expected_offset = 0;
+    // A line lacking its newline was cut short by a crash, so ignore it.
+    while (std::getline(in, line) && !in.eof()) {
+        std::istringstream fields{line};
+        Chunk chunk;
+        if (!(fields >> chunk.offset >> chunk.length >> std::hex >> chunk.checksum) ||
+            chunk.offset != expected_offset || chunk.length == 0 || chunk.offset + chunk.length > header.source_size) {
+            break;
+        }
+        chunks.push_back(chunk);
+        expected_offset += chunk.length;
+        valid_size = in.tellg();
+    }
+    return true;
+}
+
+// Return whether the contents of the destination file open as `fd` match
+// `chunk`.
+bool matches(int fd, const Chunk& chunk) {
+    std::vector<char> data(chunk.length);
+    if (posix::seek(fd, chunk.offset) ||
+        posix::read_all(fd, data.data(), data.size()) != int(data.size())) {
+        return false;
+    }
+    return checksum::crc32c(data.data(), data.size()) == chunk.checksum;
+}
+
+} // namespace
+
+Journal::Journal(std::string path)
+: path(std::move(path)) {}
+
+Journal::~Journal() {
+    if (fd >= 0) {
+        posix::close_file(fd);
+    }
+}
+
+int Journal::open(const JournalHeader& header, int destination_fd, std::size_t& resume_offset) {
+    const unsigned mode = 0644;
+    fd = posix::open_for_resuming(path.c_str(), mode);
+    if (fd < 0) {
+        return -fd;
+    }
+
+    // Every recorded chunk was synced before it was recorded, so only the
+    // last one is checked: it shows that the destination is the file that
+    // the journal describes, without reading everything already copied.
+    std::vector<Chunk> chunks;
+    std::size_t valid_size = 0;
+    if (parse(path, header, chunks, valid_size) && (chunks.empty() || matches(destination_fd, chunks.back()))) {
+        resume_offset = chunks.empty() ? 0 : chunks.back().offset + chunks.back().length;
+        // Discard anything after the last good chunk, so that appended lines
+        // follow it directly.
+        if (const int rc = posix::truncate_file(fd, valid_size)) {
+            return rc;
+        }
+        return posix::seek(fd, valid_size);
+    }
+
+    resume_offset = 0;
+    std::ostringstream out;
+    out << "copy-journal 1\nsource-size " << header.source_size << "\nsource-modified " << header.source_modified << '\n';
+    const std::string text = out.str();
+    if (const int rc = posix::truncate_file(fd, 0)) {
+        return rc;
+    }
+    if (const int rc = posix::seek(fd, 0)) {
+        return rc;
+    }
+    if (const int rc = posix::write_all(fd, text.data(), text.size()); rc < 0) {
+        return -rc;
+    }
+    return posix::sync_file_data(fd);
+}
+
+int Journal::record(std::size_t offset, std::size_t length, std::uint32_t checksum) {
+    std::ostringstream out;
+    out << offset << ' ' << length << ' ' << std::hex << checksum << '\n';
+    const std::string line = out.str();
+    if (const int rc = posix::write_all(fd, line.data(), line.size()); rc < 0) {
+        return -rc;
+    }
+    return posix::sync_file_data(fd);
+}
+
+int Journal::finish() {
+    posix::close_file(fd);
+    fd = -1;
+    return posix::remove_file(path.c_str());
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+// A `Journal` records how much of a copy has safely reached storage, so that
+// an interrupted copy can later resume where it left off rather than from the
+// beginning.
+//
+// The journal is a text file next to the destination. It begins with a header
+// describing the source file, followed by one line per durable chunk of the
+// destination:
+//
+//     copy-journal 1
+//     source-size 536870912000
+//     source-modified 1760880000123456789
+//     0 67108864 8f2a61c3
+//     67108864 67108864 04b1e9d0
+//     ...
+//
+// where each chunk line is the chunk's offset, its length, and the CRC-32C
+// of its contents, in hexadecimal. A line is appended only after the chunk's
+// data has been synced, and the journal itself is synced after each line. The
+// journal is removed once the copy is complete.
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+struct JournalHeader {
+    std::size_t source_size;
+    // time of last modification of the source, in nanoseconds since the epoch
+    std::int64_t source_modified;
+};
+
+class Journal {
+    std::string path;
+    int fd = -1;
+
+ public:
+    explicit Journal(std::string path);
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+    ~Journal();
+
+    // Determine where to resume copying into the destination file open for
+    // reading and writing as `destination_fd`, and store the offset into
+    // `resume_offset`. If the journal exists, describes the same source as
+    // `header`, and its last chunk matches the destination's contents, then
+    // the offset is the end of that chunk, and the journal is kept for
+    // appending. Otherwise, the offset is zero, and the journal is started
+    // anew. Note that the destination's contents beyond the offset are
+    // unspecified. Return zero on success, or return `errno` if an error
+    // occurs.
+    int open(const JournalHeader& header, int destination_fd, std::size_t& resume_offset);
+
+    // Record that the `length` bytes at `offset` in the destination, whose
+    // CRC-32C is `checksum`, have been synced to storage. Return zero on
+    // success, or return `errno` if an error occurs.
+    int record(std::size_t offset, std::size_t length, std::uint32_t checksum);
+
+    // Remove the journal, because the copy is complete. Return zero on
+    // success, or return `errno` if an error occurs.
+    int finish();
+};
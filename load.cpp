@@ -0,0 +1,274 @@
+#include "posix.h"
+
+#include <atomic>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <signal.h>
+
+struct Options {
+    bool help = false;
+    std::string directory;
+    std::size_t readers = 1;
+    std::size_t writers = 1;
+    std::size_t block_size = 1024 * 1024;
+    std::size_t file_size = 256 * 1024 * 1024;
+};
+
+void usage(std::string_view name, std::ostream& out);
+
+int parse_command_line(Options& options, int argc, char* argv[], std::ostream& out, std::ostream& error);
+
+// Write `file_size` bytes to the file at `path` in blocks of `block_size`,
+// syncing after each pass, over and over until `stop` is set. Return zero, or
+// return `errno` if an error occurs.
+int write_load(const std::string& path, std::size_t block_size, std::size_t file_size, const std::atomic<bool>& stop);
+
+// Read the file at `path` in blocks of `block_size` from beginning to end,
+// over and over until `stop` is set, dropping each block from the page cache
+// after reading it so that every pass reads from the storage device. Return
+// zero, or return `errno` if an error occurs.
+int read_load(const std::string& path, std::size_t block_size, const std::atomic<bool>& stop);
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (const int rc = parse_command_line(options, argc, argv, std::cout, std::cerr)) {
+        return rc;
+    } else if (options.help) {
+        return 0; // `parse_command_line` printed the usage already
+    }
+
+    // Create the readers' files before starting any load, so that the load
+    // is at full strength as soon as this program is running for a while.
+    std::vector<std::string> read_paths;
+    std::vector<std::string> write_paths;
+    const auto remove_files = [&]() {
+        for (const auto* paths : {&read_paths, &write_paths}) {
+            for (const std::string& path : *paths) {
+                posix::remove_file(path.c_str());
+            }
+        }
+    };
+    const std::unique_ptr<char[]> block{new char[options.block_size]};
+    std::memset(block.get(), 'x', options.block_size);
+    for (std::size_t i = 0; i < options.readers; ++i) {
+        const std::string path = options.directory + "/load-read-" + std::to_string(i);
+        const int fd = posix::open_for_writing(path.c_str(), 0644);
+        if (fd < 0) {
+            std::cerr << "Unable to open \"" << path << "\" for writing: " << std::strerror(-fd) << '\n';
+            remove_files();
+            return 1;
+        }
+        read_paths.push_back(path);
+        for (std::size_t written = 0; written < options.file_size; written += options.block_size) {
+            const int rc = posix::write_all(fd, block.get(), options.block_size);
+            if (rc < 0) {
+                std::cerr << "Unable to write to \"" << path << "\": " << std::strerror(-rc) << '\n';
+                posix::close_file(fd);
+                remove_files();
+                return 1;
+            }
+        }
+        // Otherwise the first pass would read what was just written from
+        // the page cache.
+        if (const int rc = posix::drop_cached(fd, 0, options.file_size)) {
+            std::cerr << "Unable to drop \"" << path << "\" from the page cache: " << std::strerror(rc) << '\n';
+            posix::close_file(fd);
+            remove_files();
+            return 1;
+        }
+        posix::close_file(fd);
+    }
+    for (std::size_t i = 0; i < options.writers; ++i) {
+        write_paths.push_back(options.directory + "/load-write-" + std::to_string(i));
+    }
+
+    // Handle SIGINT and SIGTERM in this thread only, by waiting for them
+    // below, so that the files are removed however the load is stopped. The
+    // threads created after this inherit the blocked signal mask.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    if (const int rc = pthread_sigmask(SIG_BLOCK, &signals, nullptr)) {
+        std::cerr << "Unable to block signals: " << std::strerror(rc) << '\n';
+        remove_files();
+        return 1;
+    }
+
+    std::atomic<bool> stop = false;
+    std::vector<int> results(read_paths.size() + write_paths.size());
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < read_paths.size(); ++i) {
+        threads.emplace_back([&, i]() {
+            results[i] = read_load(read_paths[i], options.block_size, stop);
+        });
+    }
+    for (std::size_t i = 0; i < write_paths.size(); ++i) {
+        threads.emplace_back([&, i]() {
+            results[read_paths.size() + i] = write_load(write_paths[i], options.block_size, options.file_size, stop);
+        });
+    }
+
+    int signal;
+    sigwait(&signals, &signal);
+    stop = true;
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    remove_files();
+
+    int status = 0;
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        if (results[i]) {
+            const std::string& path = i < read_paths.size() ? read_paths[i] : write_paths[i - read_paths.size()];
+            std::cerr << "Load on \"" << path << "\" failed: " << std::strerror(results[i]) << '\n';
+            status = 1;
+        }
+    }
+    return status;
+}
+
+int write_load(const std::string& path, std::size_t block_size, std::size_t file_size, const std::atomic<bool>& stop) {
+    const int fd = posix::open_for_writing(path.c_str(), 0644);
+    if (fd < 0) {
+        return -fd;
+    }
+    const std::unique_ptr<char[]> block{new char[block_size]};
+    std::memset(block.get(), 'x', block_size);
+    int error = 0;
+    while (!stop && !error) {
+        for (std::size_t written = 0; written < file_size && !stop; written += block_size) {
+            const int rc = posix::write_all(fd, block.get(), block_size);
+            if (rc < 0) {
+                error = -rc;
+                break;
+            }
+        }
+        if (!error) {
+            error = posix::sync_file_data(fd);
+        }
+        if (!error) {
+            error = posix::seek(fd, 0);
+        }
+    }
+    posix::close_file(fd);
+    return error;
+}
+
+int read_load(const std::string& path, std::size_t block_size, const std::atomic<bool>& stop) {
+    const int fd = posix::open_for_reading(path.c_str());
+    if (fd < 0) {
+        return -fd;
+    }
+    const std::unique_ptr<char[]> block{new char[block_size]};
+    std::size_t offset = 0;
+    int error = 0;
+    while (!stop && !error) {
+        const int rc = posix::read_all(fd, block.get(), block_size);
+        if (rc < 0) {
+            error = -rc;
+            break;
+        }
+        // The next pass must not find this block cached.
+        error = posix::drop_cached(fd, offset, rc);
+        offset += rc;
+        if (!error && std::size_t(rc) < block_size) {
+            error = posix::seek(fd, 0);
+            offset = 0;
+        }
+    }
+    posix::close_file(fd);
+    return error;
+}
+
+void usage(std::string_view program_name, std::ostream& out) {
+    out << "usage:\n\n"
+        "    " << program_name << " [--help | -h] [--readers COUNT] [--writers COUNT] [--block BYTES]\n"
+        "        [--file-size BYTES] <directory>\n\n"
+        "        --help or -h prints this message.\n"
+        "        --readers is the number of threads that each read a file in a loop. The default is 1.\n"
+        "        --writers is the number of threads that each write and sync a file in a loop. The default is 1.\n"
+        "        --block is the number of bytes per read() or write(). The default is 1048576 (1 MiB).\n"
+        "        --file-size is the size of each file read or written. The default is 268435456 (256 MiB).\n"
+        "            Readers drop what they read from the page cache, so that every read hits the storage\n"
+        "            device. On Darwin, which can't drop pages by range, the files may stay cached.\n"
+        "        <directory> is where the files are created. They are removed on SIGINT or SIGTERM.\n\n"
+        "    Generate background I/O until interrupted.\n";
+}
+
+int parse_command_line(Options& options, int argc, char* argv[], std::ostream& out, std::ostream& error) {
+    const std::string_view program_name =  argv[0];
+    if (argc < 1 + 1 || argc > 1 + 2 + 2 + 2 + 2 + 1) {
+        usage(program_name, error);
+        return 1;
+    }
+
+    bool found_directory = false;
+
+    for (++argv; *argv; ++argv) {
+        const std::string_view arg = *argv;
+        if (arg == "--help" || arg == "-h") {
+            options.help = true;
+            usage(program_name, out);
+            return 0;
+        } else if (arg == "--readers" || arg == "--writers" || arg == "--block" || arg == "--file-size") {
+            ++argv;
+            if (!*argv) {
+                usage(program_name, error);
+                error << "\nerror: " << arg << " requires an integer argument.\n";
+                return 1;
+            }
+            long long value;
+            try {
+                value = std::stoll(*argv);
+            } catch (const std::exception&) {
+                usage(program_name, error);
+                error << "\nerror: \"" << *argv << "\" is not a valid integer argument for " << arg << '\n';
+                return 1;
+            }
+            // Zero readers or writers is fine, but not zero-sized blocks.
+            const bool is_count = arg == "--readers" || arg == "--writers";
+            if (value < (is_count ? 0 : 1)) {
+                usage(program_name, error);
+                error << "\nerror: " << arg << " argument must be at least " << (is_count ? 0 : 1) << ".\n";
+                return 1;
+            }
+            if (arg == "--readers") {
+                options.readers = value;
+            } else if (arg == "--writers") {
+                options.writers = value;
+            } else if (arg == "--block") {
+                options.block_size = value;
+            } else {
+                options.file_size = value;
+            }
+        } else if (arg.substr(0, 1) == "-") {
+            usage(program_name, error);
+            error << "\nerror: Unknown option \"" << arg << "\". If you meant a directory name, use \"./" << arg << "\".\n";
+            return 1;
+        } else if (found_directory) {
+            usage(program_name, error);
+            return 1;
+        } else {
+            options.directory = arg;
+            found_directory = true;
+        }
+    }
+
+    if (!found_directory) {
+        usage(program_name, error);
+        error << "\ndirectory argument is required.\n";
+        return 1;
+    }
+
+    return 0;
+}
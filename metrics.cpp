@@ -0,0 +1,180 @@
+#include "metrics.h"
+#include "posix.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include <unistd.h>
+
+Metrics::Metrics(const MetricsOptions& options)
+: options(options)
+, file_window{.since = Clock::now()}
+, socket_window{.since = Clock::now()} {
+}
+
+Metrics::~Metrics() {
+    stop();
+}
+
+bool Metrics::enabled() const {
+    return !options.path.empty() || !options.socket.empty();
+}
+
+ThreadCounters& Metrics::thread_counters() {
+    std::lock_guard<std::mutex> lock{mutex};
+    return threads.emplace_back();
+}
+
+void Metrics::add_queue_depth(std::int64_t delta) {
+    queue_depth.fetch_add(delta, std::memory_order_relaxed);
+}
+
+int Metrics::start() {
+    if (!options.socket.empty()) {
+        listener = posix::listen_on_unix_socket(options.socket.c_str());
+        if (listener < 0) {
+            const int error = -listener;
+            listener = -1;
+            return error;
+        }
+        exporter = std::thread([this]() { export_to_socket(); });
+    } else if (!options.path.empty()) {
+        exporter = std::thread([this]() { export_to_file(); });
+    }
+    return 0;
+}
+
+int Metrics::stop() {
+    if (!exporter.joinable()) {
+        return 0;
+    }
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        stopping = true;
+    }
+    stop_requested.notify_one();
+    exporter.join();
+    if (listener != -1) {
+        posix::close_file(listener);
+        posix::remove_file(options.socket.c_str());
+        listener = -1;
+    }
+    return options.path.empty() ? 0 : write_file();
+}
+
+void Metrics::export_to_file() {
+    bool reported = false;
+    std::unique_lock<std::mutex> lock{mutex};
+    while (!stop_requested.wait_for(lock, options.interval, [this]() { return stopping; })) {
+        lock.unlock();
+        // Report only the first failure, rather than one per interval.
+        if (const int rc = write_file(); rc && !reported) {
+            std::cerr << "Unable to write metrics to \"" << options.path << "\": " << std::strerror(rc) << '\n';
+            reported = true;
+        }
+        lock.lock();
+    }
+}
+
+void Metrics::export_to_socket() {
+    // Wake up now and then to see whether to stop.
+    const int timeout_millis = 100;
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            if (stopping) {
+                return;
+            }
+        }
+        if (posix::wait_for_input(listener, timeout_millis) <= 0) {
+            continue;
+        }
+        const int fd = posix::accept_connection(listener);
+        if (fd < 0) {
+            continue;
+        }
+        // The client might not read everything, or might already be gone.
+        // Either way, it's not our problem, and it mustn't kill us with
+        // `SIGPIPE`.
+        const std::string text = render(socket_window);
+        posix::send_all(fd, text.data(), text.size());
+        posix::close_file(fd);
+    }
+}
+
+int Metrics::write_file() {
+    // Replace the file atomically, so that a reader never sees it half
+    // written. Each process writes its own temporary file, so that processes
+    // exporting to the same path don't write into each other's.
+    const std::string temporary = options.path + '.' + std::to_string(::getpid()) + ".tmp";
+    const int fd = posix::open_for_writing(temporary.c_str(), 0644);
+    if (fd < 0) {
+        return -fd;
+    }
+    const std::string text = render(file_window);
+    const int rc = posix::write_all(fd, text.data(), text.size());
+    posix::close_file(fd);
+    if (rc < 0) {
+        posix::remove_file(temporary.c_str());
+        return -rc;
+    }
+    if (std::rename(temporary.c_str(), options.path.c_str())) {
+        const int error = errno;
+        posix::remove_file(temporary.c_str());
+        return error;
+    }
+    return 0;
+}
+
+std::string Metrics::render(ThroughputWindow& window) {
+    std::uint64_t totals[counter_count] = {};
+    double throughput;
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        for (const ThreadCounters& counters : threads) {
+            for (std::size_t i = 0; i < counter_count; ++i) {
+                totals[i] += counters.get(Counter(i));
+            }
+        }
+        const auto now = Clock::now();
+        const std::uint64_t bytes = totals[std::size_t(Counter::BYTES_COPIED)];
+        const double seconds = std::chrono::duration<double>(now - window.since).count();
+        throughput = seconds > 0 ? (bytes - window.bytes) / seconds : 0;
+        window = {.since = now, .bytes = bytes};
+    }
+    const auto total = [&](Counter counter) {
+        return totals[std::size_t(counter)];
+    };
+    const auto faults = posix::page_faults();
+
+    std::ostringstream out;
+    out << "# TYPE copy_bytes counter\n"
+           "# UNIT copy_bytes bytes\n"
+           "# HELP copy_bytes Bytes copied.\n"
+           "copy_bytes_total " << total(Counter::BYTES_COPIED) << "\n"
+           "# TYPE copy_files counter\n"
+           "# HELP copy_files Files copied completely.\n"
+           "copy_files_total " << total(Counter::FILES_COPIED) << "\n"
+           "# TYPE copy_system_calls counter\n"
+           "# HELP copy_system_calls System calls that moved data. \"copy\" is sendfile() or copyfile().\n"
+           "copy_system_calls_total{call=\"read\"} " << total(Counter::READ_CALLS) << "\n"
+           "copy_system_calls_total{call=\"write\"} " << total(Counter::WRITE_CALLS) << "\n"
+           "copy_system_calls_total{call=\"copy\"} " << total(Counter::COPY_CALLS) << "\n"
+           "# TYPE copy_throughput_bytes_per_second gauge\n"
+           "# HELP copy_throughput_bytes_per_second Bytes copied per second since the previous export.\n"
+           "copy_throughput_bytes_per_second " << throughput << "\n"
+           "# TYPE copy_queue_depth gauge\n"
+           "# HELP copy_queue_depth Copies waiting to be done.\n"
+           "copy_queue_depth " << queue_depth.load(std::memory_order_relaxed) << '\n';
+    if (faults.error == 0) {
+        out << "# TYPE process_page_faults counter\n"
+               "# HELP process_page_faults Page faults of this process, by whether they needed I/O.\n"
+               "process_page_faults_total{kind=\"minor\"} " << faults.minor << "\n"
+               "process_page_faults_total{kind=\"major\"} " << faults.major << '\n';
+    }
+    out << "# EOF\n";
+    return out.str();
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+// `Metrics` makes a running copy observable from outside. Copy loops count
+// what they do in per-thread counters, and a background thread periodically
+// adds them up and exports them in the OpenMetrics text format, either by
+// replacing a file or by answering connections on a Unix domain socket.
+//
+// Each thread's counters are written only by that thread, so counting is a
+// relaxed load and store to a cache line that no other thread writes. That's
+// cheap enough to do for every system call.
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+enum class Counter {
+    BYTES_COPIED,
+    FILES_COPIED,
+    READ_CALLS,
+    WRITE_CALLS,
+    // sendfile() on Linux, copyfile() on Darwin
+    COPY_CALLS,
+};
+
+constexpr std::size_t counter_count = std::size_t(Counter::COPY_CALLS) + 1;
+
+class alignas(64) ThreadCounters {
+    std::atomic<std::uint64_t> values[counter_count] = {};
+
+ public:
+    // Add `amount` to `counter`. Only the thread that owns these counters may
+    // call this.
+    void add(Counter counter, std::uint64_t amount) {
+        std::atomic<std::uint64_t>& value = values[std::size_t(counter)];
+        value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    std::uint64_t get(Counter counter) const {
+        return values[std::size_t(counter)].load(std::memory_order_relaxed);
+    }
+};
+
+struct MetricsOptions {
+    // If not empty, the file to replace with the current metrics every
+    // `interval`.
+    std::string path;
+    // If not empty, the Unix domain socket on which to send the current
+    // metrics to whoever connects.
+    std::string socket;
+    std::chrono::milliseconds interval{1000};
+};
+
+class Metrics {
+    using Clock = std::chrono::steady_clock;
+
+    // what one consumer of the metrics last saw, for calculating throughput
+    // since then
+    struct ThroughputWindow {
+        Clock::time_point since;
+        std::uint64_t bytes = 0;
+    };
+
+    MetricsOptions options;
+    std::mutex mutex;
+    // A deque, so that the counters don't move when another thread registers.
+    std::deque<ThreadCounters> threads;
+    std::atomic<std::int64_t> queue_depth = 0;
+    // The file and the socket each have their own window, so that a client
+    // of the socket doesn't change the throughput written to the file.
+    ThroughputWindow file_window;
+    ThroughputWindow socket_window;
+    bool stopping = false;
+    std::condition_variable stop_requested;
+    std::thread exporter;
+    int listener = -1;
+
+    // Replace the metrics file with the current metrics. Return zero on
+    // success, or return `errno` if an error occurs.
+    int write_file();
+
+    void export_to_file();
+    void export_to_socket();
+
+    // Return the current metrics in the OpenMetrics text format, with the
+    // throughput since `window`, and then move `window` up to now.
+    std::string render(ThroughputWindow& window);
+
+ public:
+    explicit Metrics(const MetricsOptions& options);
+    ~Metrics();
+
+    // Return whether metrics are exported anywhere.
+    bool enabled() const;
+
+    // Return new counters for the calling thread.
+    ThreadCounters& thread_counters();
+
+    // Add `delta` to the number of jobs waiting to be done.
+    void add_queue_depth(std::int64_t delta);
+
+    // Begin exporting. Return zero on success, or return `errno` if an error
+    // occurs.
+    int start();
+
+    // Stop exporting, and write the metrics file one last time if there is
+    // one. Return zero on success, or return `errno` if an error occurs.
+    int stop();
+};
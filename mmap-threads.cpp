@@ -0,0 +1,320 @@
+#include "posix.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <map>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+struct Options {
+    bool help = false;
+    std::string source;
+    std::string destination;
+    std::size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    bool numa = false;
+    // -1 means the node nearest the destination's (or else the source's) device
+    int numa_node = -1;
+};
+
+// What one thread of `parallel_copy` did
+struct SliceResult {
+    // the NUMA node on which the thread finished, or -1 if unknown
+    int numa_node;
+    std::size_t bytes;
+    std::chrono::steady_clock::duration elapsed;
+};
+
+void usage(std::string_view name, std::ostream& out);
+
+int parse_command_line(Options& options, int argc, char* argv[], std::ostream& out, std::ostream& error);
+
+// Copy `count` bytes from `source` to `destination` using at most `threads`
+// threads, each of which copies a contiguous slice. Slices are aligned to huge
+// page boundaries so that no two threads fault on the same huge page. If
+// `numa_node` is not -1, then run every thread on that NUMA node. Return what
+// each thread did.
+std::vector<SliceResult> parallel_copy(const char* source, char* destination, std::size_t count, std::size_t threads, int numa_node);
+
+// Print to `out` the bandwidth achieved on each NUMA node in `results`.
+void report_numa_bandwidth(const std::vector<SliceResult>& results, std::ostream& out);
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (const int rc = parse_command_line(options, argc, argv, std::cout, std::cerr)) {
+        return rc;
+    } else if (options.help) {
+        return 0; // `parse_command_line` printed the usage already
+    }
+
+    class Closer {
+        int fd;
+     public:
+        explicit Closer(int fd) : fd(fd) {}
+        ~Closer() {
+            posix::close_file(fd);
+        }
+    };
+
+    class Unmapper {
+        void *address;
+        std::size_t count;
+        std::string path;
+     public:
+        Unmapper(void* address, std::size_t count, const std::string& path) : address(address), count(count), path(path) {}
+        ~Unmapper() {
+            if (const int rc = posix::memory_unmap(address, count)) {
+                std::cerr << "Failed to unmap memory for \"" << path << "\": " << std::strerror(rc) << '\n';
+            }
+        }
+    };
+
+    const int source_fd = posix::open_for_reading(options.source.c_str());
+    if (source_fd < 0) {
+        std::cerr << "Unable to open \"" << options.source << "\" for reading: " << std::strerror(-source_fd) << '\n';
+        return 1;
+    }
+    Closer source_closer{source_fd};
+    
+    const auto [error, status] = posix::file_status(source_fd);
+    if (error) {
+        std::cerr << "Unable to determine the file mode/size of \"" << options.source << "\": " << std::strerror(error) << '\n';
+        return 1;
+    }
+    if (status.size == 0) {
+        // There's nothing to map. Creating (or truncating) the destination is
+        // the entire copy.
+        const int destination_fd = posix::open_for_writing(options.destination.c_str(), status.mode);
+        if (destination_fd < 0) {
+            std::cerr << "Unable to open or create \"" << options.destination << "\" for writing: " << std::strerror(-destination_fd) << '\n';
+            return 1;
+        }
+        posix::close_file(destination_fd);
+        return 0;
+    }
+
+    const auto source = posix::memory_map_for_reading(source_fd, status.size);
+    if (source.error) {
+        std::cerr << "Unable to mmap \"" << options.source << "\" for reading: " << std::strerror(source.error) << '\n';
+        return 1;
+    }
+    Unmapper source_unmapper{source.address, status.size, options.source};
+
+    const auto dest = posix::open_and_memory_map_for_writing(options.destination.c_str(), status.mode, status.size);
+    if (dest.error) {
+        std::cerr << "Unable to open/mmap \"" << options.destination << "\" for writing: " << std::strerror(dest.error) << '\n';
+        return 1;
+    }
+    Closer destination_closer{dest.fd};
+    Unmapper destination_unmapper{dest.address, status.size, options.destination};
+
+    const int in_memory = posix::file_system_is_memory(dest.fd);
+    if (in_memory < 0) {
+        std::cerr << "Unable to determine the file system type of \"" << options.destination << "\": " << std::strerror(-in_memory) << '\n';
+        return 1;
+    }
+
+    // Huge pages matter only when the copy is bound by memory, which is when
+    // the destination is in memory. tmpfs honors the advice when mounted with
+    // "huge=advise" (or when shmem_enabled is "advise"). The advice is only
+    // advice, so failing to give it is not an error.
+    if (in_memory) {
+        posix::memory_advise_huge_pages(dest.address, status.size);
+    }
+
+    if (options.numa && options.numa_node == -1) {
+        const auto [error, node] = posix::copy_numa_node(source_fd, dest.fd);
+        if (error) {
+            std::cerr << "Unable to determine the NUMA node of a file's device: " << std::strerror(error) << '\n';
+            return 1;
+        }
+        options.numa_node = node;
+    }
+    // Fail here rather than in every thread.
+    if (options.numa) {
+        if (const int rc = posix::bind_thread_to_numa_node(options.numa_node)) {
+            std::cerr << "Unable to run on NUMA node " << options.numa_node << ": " << std::strerror(rc) << '\n';
+            return 1;
+        }
+    }
+
+    const auto results = parallel_copy(
+        static_cast<const char*>(source.address), static_cast<char*>(dest.address), status.size, options.threads,
+        options.numa ? options.numa_node : -1);
+    if (options.numa) {
+        // Standard output might be mixed with `jsontime`'s, so report on
+        // standard error.
+        report_numa_bandwidth(results, std::cerr);
+    }
+
+    // The contents of a memory-backed file system are never written anywhere,
+    // so there is nothing to wait for.
+    if (in_memory) {
+        return 0;
+    }
+    if (const int rc = posix::memory_sync(dest.address, status.size)) {
+        std::cerr << "Unable to synchronize written memory region to \"" << options.destination << "\": " << std::strerror(rc) << '\n';
+        return 1;
+    }
+}
+
+std::vector<SliceResult> parallel_copy(const char* source, char* destination, std::size_t count, std::size_t threads, int numa_node) {
+    const std::size_t huge_page = 2 * 1024 * 1024;
+    // Starting a thread costs more than copying a huge page, so don't give any
+    // thread less than a few of them.
+    const std::size_t min_slice = 4 * huge_page;
+    threads = std::clamp<std::size_t>(count / min_slice, 1, threads);
+
+    std::size_t slice = (count + threads - 1) / threads;
+    slice = (slice + huge_page - 1) / huge_page * huge_page;
+
+    std::vector<SliceResult> results((count + slice - 1) / slice);
+    const auto copy_slice = [=](std::size_t offset, SliceResult& result) {
+        // `main` already bound its own thread, and checked for errors.
+        if (numa_node != -1 && offset != 0) {
+            posix::bind_thread_to_numa_node(numa_node);
+        }
+        const auto before = std::chrono::steady_clock::now();
+        const std::size_t length = std::min(slice, count - offset);
+        std::copy_n(source + offset, length, destination + offset);
+        result.elapsed = std::chrono::steady_clock::now() - before;
+        result.bytes = length;
+        result.numa_node = posix::current_numa_node();
+    };
+
+    std::vector<std::thread> workers;
+    for (std::size_t offset = slice; offset < count; offset += slice) {
+        workers.emplace_back(copy_slice, offset, std::ref(results[offset / slice]));
+    }
+    // This thread takes the first slice.
+    copy_slice(0, results[0]);
+
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    return results;
+}
+
+void report_numa_bandwidth(const std::vector<SliceResult>& results, std::ostream& out) {
+    struct NodeTotal {
+        std::size_t bytes = 0;
+        std::chrono::steady_clock::duration elapsed{};
+    };
+    // A node's threads run concurrently, so its bandwidth is its total bytes
+    // divided by the time taken by its slowest thread.
+    std::map<int, NodeTotal> nodes;
+    for (const SliceResult& result : results) {
+        NodeTotal& node = nodes[std::max(-1, result.numa_node)];
+        node.bytes += result.bytes;
+        node.elapsed = std::max(node.elapsed, result.elapsed);
+    }
+    for (const auto& [node, total] : nodes) {
+        out << "{\"numa_node\": " << node << ", \"bytes\": " << total.bytes
+            << ", \"micros\": " << std::chrono::duration_cast<std::chrono::microseconds>(total.elapsed).count() << "}\n";
+    }
+}
+
+void usage(std::string_view program_name, std::ostream& out) {
+    out << "usage:\n\n"
+        "    " << program_name << " [--help | -h] [--threads N] [--numa auto | --numa NODE] <source file> <destination file>\n\n"
+        "        --help or -h prints this message.\n"
+        "        N is the maximum number of threads that copy. It defaults to the number of CPUs.\n"
+        "        --numa runs every thread on NUMA NODE. \"auto\" chooses the node nearest the destination's\n"
+        "            storage device, or else the source's. The bandwidth achieved on each node is printed to\n"
+        "            standard error.\n"
+        "        <source file> is the path to the input file, to be read from.\n"
+        "        <destination file> is the path to the output file, to be created/truncated and written to.\n";
+}
+
+int parse_command_line(Options& options, int argc, char* argv[], std::ostream& out, std::ostream& error) {
+    const std::string_view program_name =  argv[0];
+    if (argc < 1 + 1 || argc > 1 + 1 + 2 + 2 + 2) {
+        usage(program_name, error);
+        return 1;
+    }
+
+    bool found_source = false;
+    bool found_destination = false;
+
+    for (++argv; *argv; ++argv) {
+        const std::string_view arg = *argv;
+        if (arg == "--help" || arg == "-h") {
+            options.help = true;
+            usage(program_name, out);
+            return 0;
+        } else if (arg == "--threads") {
+            ++argv;
+            if (!*argv) {
+                usage(program_name, error);
+                error << "\nerror: --threads requires an integer argument.\n";
+                return 1;
+            }
+            long long value;
+            try {
+                value = std::stoll(*argv);
+            } catch (const std::exception&) {
+                usage(program_name, error);
+                error << "\nerror: \"" << *argv << "\" is not a valid integer argument for --threads\n";
+                return 1;
+            }
+            if (value < 1) {
+                usage(program_name, error);
+                error << "\nerror: --threads argument must be at least 1.\n";
+                return 1;
+            }
+            options.threads = value;
+        } else if (arg == "--numa") {
+            ++argv;
+            if (!*argv) {
+                usage(program_name, error);
+                error << "\nerror: --numa requires an argument.\n";
+                return 1;
+            }
+            options.numa = true;
+            if (std::string_view(*argv) == "auto") {
+                options.numa_node = -1;
+                continue;
+            }
+            long long value;
+            try {
+                value = std::stoll(*argv);
+            } catch (const std::exception&) {
+                usage(program_name, error);
+                error << "\nerror: \"" << *argv << "\" is not a valid argument for --numa\n";
+                return 1;
+            }
+            if (value < 0 || value >= 1024) {
+                usage(program_name, error);
+                error << "\nerror: --numa node must be between 0 and 1023.\n";
+                return 1;
+            }
+            options.numa_node = value;
+        } else if (arg.substr(0, 1) == "-") {
+            usage(program_name, error);
+            error << "\nerror: Unknown option \"" << arg << "\". If you meant a file name, use \"./" << arg << "\".\n";
+            return 1;
+        } else if (found_source && found_destination) {
+            usage(program_name, error);
+            return 1;
+        } else if (found_source) {
+            options.destination = arg;
+            found_destination = true;
+        } else {
+            options.source = arg;
+            found_source = true;
+        }
+    }
+
+    if (!found_destination) {
+        usage(program_name, error);
+        error << "\nsource file and destination file arguments are required.\n";
+        return 1;
+    }
+
+    return 0;
+}
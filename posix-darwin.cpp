@@ -1,19 +1,179 @@
 #include "posix.h"
 
+#include <algorithm>
 #include <cerrno>
+#include <cstring>
+#include <vector>
 
 #include <copyfile.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/mount.h>
+#include <sys/param.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace posix {
 
-int copy_all(const char* source_path, const char* destination_path) {
+int file_system_is_memory(int fd) {
+    struct statfs file_system_info;
+    if (::fstatfs(fd, &file_system_info)) {
+        return -errno;
+    }
+    // Darwin has no tmpfs of its own, but third party file systems might.
+    return std::strcmp(file_system_info.f_fstypename, "tmpfs") == 0;
+}
+
+int memory_advise_huge_pages(void*, std::size_t) {
+    // Darwin has no madvise() equivalent of MADV_HUGEPAGE. Advice can always
+    // be ignored, so succeed without doing anything.
+    return 0;
+}
+
+// Darwin machines have a single NUMA node, numbered zero.
+
+NumaNodeResult file_numa_node(int) {
+    return {.error = 0, .node = -1};
+}
+
+int current_numa_node() {
+    return 0;
+}
+
+int bind_thread_to_numa_node(int node) {
+    return node == 0 ? 0 : EINVAL;
+}
+
+MemoryMapResult allocate_on_numa_node(std::size_t count, int node) {
+    if (node != 0) {
+        return {.error=EINVAL, .address=nullptr, .fd=-1};
+    }
+    const int protection = PROT_READ | PROT_WRITE;
+    const int flags = MAP_PRIVATE | MAP_ANON;
+    void* address = ::mmap(nullptr, count, protection, flags, -1, 0);
+    if (address == MAP_FAILED) {
+        return {.error=errno, .address=nullptr, .fd=-1};
+    }
+    return {.error=0, .address=address, .fd=-1};
+}
+
+int set_io_priority(IoClass io_class, int) {
+    // Darwin's policies don't have levels. "Throttle" is the nearest to idle,
+    // and "utility" to a lowered best effort.
+    const int policy = io_class == IoClass::IDLE ? IOPOL_THROTTLE : IOPOL_UTILITY;
+    if (::setiopolicy_np(IOPOL_TYPE_DISK, IOPOL_SCOPE_PROCESS, policy)) {
+        return errno;
+    }
+    return 0;
+}
+
+int copy_all(const char* source_path, const char* destination_path, const CopyOptions& options) {
+    // `copyfile` does all of its work in one call, so the best we can do is
+    // to present the whole file as one chunk.
+    std::size_t size = 0;
+    if (options.before_chunk || options.after_chunk) {
+        struct stat file_info;
+        if (::stat(source_path, &file_info)) {
+            return errno;
+        }
+        size = file_info.st_size;
+    }
+    if (options.before_chunk) {
+        options.before_chunk(size);
+    }
+
     copyfile_state_t state = ::copyfile_state_alloc();
     const int rc = ::copyfile(source_path, destination_path, state, COPYFILE_ALL);
     ::copyfile_state_free(state);
     if (rc < 0) {
         return errno;
     }
+
+    if (options.after_chunk) {
+        options.after_chunk(size);
+    }
+    return 0;
+}
+
+int copy_metadata(int source_fd, const FileStatus&, int destination_fd) {
+    // `fcopyfile` reads the metadata it needs from `source_fd` itself.
+    if (::fcopyfile(source_fd, destination_fd, nullptr, COPYFILE_METADATA) < 0) {
+        return errno;
+    }
+    return 0;
+}
+
+CacheResidency cache_residency(int fd, std::size_t offset, std::size_t count) {
+    return mapped_cache_residency(fd, offset, count);
+}
+
+int advise_sequential(int fd) {
+    // Darwin has no `posix_fadvise()`, but it can be told to read ahead.
+    if (::fcntl(fd, F_RDAHEAD, 1) == -1) {
+        return errno;
+    }
+    return 0;
+}
+
+int start_writeback(int, std::size_t, std::size_t) {
+    return 0;
+}
+
+int drop_cached(int, std::size_t, std::size_t) {
+    return 0;
+}
+
+int clone_file(int, int) {
+    // Darwin's `clonefile()` family creates the destination by name, rather
+    // than filling an open file.
+    return ENOTSUP;
+}
+
+namespace {
+
+// Copy `count` bytes from `source_fd` to `destination_fd` through a buffer.
+// Darwin has neither `splice()` nor `MSG_ZEROCOPY`, and its `sendfile()`
+// can't be throttled in chunks as easily, so both directions use this.
+int read_and_write(int source_fd, int destination_fd, std::size_t count, const CopyOptions& options) {
+    std::vector<char> buffer(std::min<std::size_t>(count, 1024 * 1024));
+    std::size_t total = 0;
+    while (total < count) {
+        std::size_t chunk = std::min(count - total, buffer.size());
+        if (options.chunk_size) {
+            chunk = std::min(chunk, options.chunk_size);
+        }
+        if (options.before_chunk) {
+            options.before_chunk(chunk);
+        }
+        const int received = read_all(source_fd, buffer.data(), chunk);
+        if (received < 0) {
+            return -received;
+        } else if (std::size_t(received) < chunk) {
+            return ECONNRESET; // the source ended early
+        }
+        if (const int rc = write_all(destination_fd, buffer.data(), received); rc < 0) {
+            return -rc;
+        }
+        total += received;
+        if (options.after_chunk) {
+            options.after_chunk(received);
+        }
+    }
     return 0;
 }
 
+} // namespace
+
+int send_file(int socket_fd, int file_fd, std::size_t count, const CopyOptions& options) {
+    if (::lseek(file_fd, 0, SEEK_SET) == -1) {
+        return errno;
+    }
+    return read_and_write(file_fd, socket_fd, count, options);
+}
+
+int receive_file(int socket_fd, int file_fd, std::size_t count, const CopyOptions& options) {
+    return read_and_write(socket_fd, file_fd, count, options);
+}
+
 } // namespace posix
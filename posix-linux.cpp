@@ -1,12 +1,227 @@
+#include "cache.h"
 #include "posix.h"
 
+#include <algorithm>
 #include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <vector>
 
+#include <linux/magic.h>
+#include <fcntl.h>
+#include <linux/errqueue.h>
+#include <linux/fs.h>
+#include <linux/mempolicy.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/xattr.h>
+#include <sys/sysmacros.h>
+#include <sys/vfs.h>
+#include <unistd.h>
 
 namespace posix {
 
-int copy_all(const char* source_path, const char* destination_path) {
+int file_system_is_memory(int fd) {
+    struct statfs file_system_info;
+    if (::fstatfs(fd, &file_system_info)) {
+        return -errno;
+    }
+    return file_system_info.f_type == TMPFS_MAGIC || file_system_info.f_type == RAMFS_MAGIC;
+}
+
+int memory_advise_huge_pages(void* address, std::size_t count) {
+    if (::madvise(address, count, MADV_HUGEPAGE)) {
+        return errno;
+    }
+    return 0;
+}
+
+NumaNodeResult file_numa_node(int fd) {
+    struct stat file_info;
+    if (::fstat(fd, &file_info)) {
+        return {.error = errno, .node = -1};
+    }
+
+    // "/sys/dev/block/MAJOR:MINOR" links to the device's directory somewhere
+    // under "/sys/devices". The nearest ancestor (including itself) that has a
+    // "numa_node" file is the bus device through which the block device is
+    // attached, e.g. a PCI function. Partitions and virtual devices are nested
+    // below it.
+    std::error_code error;
+    std::filesystem::path device = std::filesystem::canonical(
+        "/sys/dev/block/" + std::to_string(major(file_info.st_dev)) + ':' + std::to_string(minor(file_info.st_dev)), error);
+    if (error) {
+        return {.error = 0, .node = -1}; // not a block device, e.g. tmpfs
+    }
+    for (; device.has_relative_path(); device = device.parent_path()) {
+        std::ifstream numa_node{device / "numa_node"};
+        int node;
+        if (numa_node >> node) {
+            return {.error = 0, .node = node};
+        }
+    }
+    return {.error = 0, .node = -1};
+}
+
+int current_numa_node() {
+    unsigned cpu;
+    unsigned node;
+    if (::getcpu(&cpu, &node)) {
+        return -errno;
+    }
+    return node;
+}
+
+int bind_thread_to_numa_node(int node) {
+    // The file contains ranges of CPU numbers, e.g. "0-7,16-23".
+    std::ifstream cpulist{"/sys/devices/system/node/node" + std::to_string(node) + "/cpulist"};
+    if (!cpulist) {
+        return EINVAL; // no such node
+    }
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    int first;
+    while (cpulist >> first) {
+        int last = first;
+        if (cpulist.peek() == '-') {
+            cpulist.ignore();
+            cpulist >> last;
+        }
+        for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu) {
+            CPU_SET(cpu, &cpus);
+        }
+        if (cpulist.peek() == ',') {
+            cpulist.ignore();
+        }
+    }
+    if (CPU_COUNT(&cpus) == 0) {
+        return EINVAL; // a node having memory but no CPUs
+    }
+    // zero means the calling thread
+    if (::sched_setaffinity(0, sizeof cpus, &cpus)) {
+        return errno;
+    }
+    return 0;
+}
+
+MemoryMapResult allocate_on_numa_node(std::size_t count, int node) {
+    const int protection = PROT_READ | PROT_WRITE;
+    const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    void* address = ::mmap(nullptr, count, protection, flags, -1, 0);
+    if (address == MAP_FAILED) {
+        return {.error=errno, .address=nullptr, .fd=-1};
+    }
+
+    // glibc has no wrapper for mbind(); that's in libnuma, which we'd rather
+    // not depend on. "Preferred" falls back to other nodes if `node` is full.
+    const unsigned long bits_per_word = 8 * sizeof(unsigned long);
+    unsigned long node_mask[1024 / bits_per_word] = {};
+    if (node < 0 || node >= 1024) {
+        ::munmap(address, count);
+        return {.error=EINVAL, .address=nullptr, .fd=-1};
+    }
+    node_mask[node / bits_per_word] = 1UL << (node % bits_per_word);
+    if (::syscall(SYS_mbind, address, count, MPOL_PREFERRED, node_mask, 1024 + 1, 0)) {
+        const int error = errno;
+        ::munmap(address, count);
+        return {.error=error, .address=nullptr, .fd=-1};
+    }
+
+    const std::size_t page = page_size();
+    for (std::size_t offset = 0; offset < count; offset += page) {
+        static_cast<volatile char*>(address)[offset] = 0;
+    }
+    return {.error=0, .address=address, .fd=-1};
+}
+
+int set_io_priority(IoClass io_class, int level) {
+    // These are from <linux/ioprio.h>, which older kernel headers lack.
+    const int who_process = 1;
+    const int class_shift = 13;
+    const int best_effort = 2;
+    const int idle = 3;
+
+    const int value = io_class == IoClass::IDLE ? idle << class_shift : best_effort << class_shift | level;
+    // zero means the calling process
+    if (::syscall(SYS_ioprio_set, who_process, 0, value)) {
+        return errno;
+    }
+    return 0;
+}
+
+CacheResidency cache_residency(int fd, std::size_t offset, std::size_t count) {
+    // `cachestat()` takes a length of zero to mean "to the end of the file."
+    if (count == 0) {
+        return {.error = 0, .cached_pages = 0, .total_pages = 0};
+    }
+    // These are from <linux/mman.h> and <sys/syscall.h>, which older headers
+    // lack. New system calls have the same number on every architecture.
+    struct Range {
+        std::uint64_t offset;
+        std::uint64_t length;
+    };
+    struct Statistics {
+        std::uint64_t cached;
+        std::uint64_t dirty;
+        std::uint64_t writeback;
+        std::uint64_t evicted;
+        std::uint64_t recently_evicted;
+    };
+    const long cachestat = 451;
+
+    const Range range{.offset = offset, .length = count};
+    Statistics statistics;
+    if (::syscall(cachestat, fd, &range, &statistics, 0) == -1) {
+        // Older kernels don't have it, and some file systems don't support it.
+        if (errno == ENOSYS || errno == EOPNOTSUPP) {
+            return mapped_cache_residency(fd, offset, count);
+        }
+        return {.error = errno, .cached_pages = 0, .total_pages = 0};
+    }
+    const std::size_t page = page_size();
+    return {.error = 0, .cached_pages = statistics.cached, .total_pages = (offset + count + page - 1) / page - offset / page};
+}
+
+int advise_sequential(int fd) {
+    // `posix_fadvise` returns the error rather than setting `errno`.
+    return ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+}
+
+int start_writeback(int fd, std::size_t offset, std::size_t count) {
+    // `sync_file_range()` takes a count of zero to mean "to the end of the
+    // file."
+    if (count == 0) {
+        return 0;
+    }
+    if (::sync_file_range(fd, offset, count, SYNC_FILE_RANGE_WRITE) == -1) {
+        return errno;
+    }
+    return 0;
+}
+
+int drop_cached(int fd, std::size_t offset, std::size_t count) {
+    if (count == 0) {
+        return 0;
+    }
+    const unsigned flags = SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER;
+    if (::sync_file_range(fd, offset, count, flags) == -1) {
+        return errno;
+    }
+    return ::posix_fadvise(fd, offset, count, POSIX_FADV_DONTNEED);
+}
+
+int copy_all(const char* source_path, const char* destination_path, const CopyOptions& options) {
     class Closer {
         int fd;
      public:
@@ -33,16 +248,339 @@ int copy_all(const char* source_path, const char* destination_path) {
     }
     Closer destination_closer{destination_fd};
 
+    std::optional<CacheWindow> cache_window;
+    if (options.cache_window) {
+        cache_window.emplace(source_fd, destination_fd, options.cache_window);
+        if (const int rc = cache_window->start(status.size)) {
+            return rc;
+        }
+    }
+
     std::size_t total = 0;
     while (total < status.size) {
+        std::size_t count = status.size - total;
+        if (options.chunk_size) {
+            count = std::min(count, options.chunk_size);
+        }
+        if (cache_window) {
+            count = std::min(count, std::max(page_size(), options.cache_window / 4));
+        }
+        if (options.before_chunk) {
+            options.before_chunk(count);
+        }
         off_t* const offset = nullptr;
-        const ssize_t rc = ::sendfile(destination_fd, source_fd, offset, status.size - total);
+        const ssize_t rc = ::sendfile(destination_fd, source_fd, offset, count);
         if (rc == -1) {
             return errno;
         }
         total += rc;
+        if (options.after_chunk) {
+            options.after_chunk(rc);
+        }
+        if (cache_window) {
+            if (const int rc = cache_window->after_chunk(total)) {
+                return rc;
+            }
+        }
+    }
+    if (cache_window) {
+        if (const int rc = cache_window->finish(total)) {
+            return rc;
+        }
+    }
+    return options.preserve ? copy_metadata(source_fd, status, destination_fd) : 0;
+}
+
+int copy_metadata(int source_fd, const FileStatus& status, int destination_fd) {
+    // Change the owner first. Changing the owner removes the
+    // "security.capability" attribute, and it clears the set-user-ID and
+    // set-group-ID bits, so the attributes and permissions come after it.
+    // Only a privileged process may give a file away, so otherwise the copy
+    // stays ours.
+    if (::fchown(destination_fd, status.owner, status.group) == -1 && errno != EPERM) {
+        return errno;
+    }
+
+    // The names of the extended attributes come as one list, each name
+    // followed by a zero byte. The list and each value in turn reuse a
+    // buffer, which grows if the kernel says it's too small.
+    std::vector<char> names(1024);
+    ssize_t names_length;
+    for (;;) {
+        names_length = ::flistxattr(source_fd, names.data(), names.size());
+        if (names_length >= 0) {
+            break;
+        } else if (errno == ENOTSUP) {
+            names_length = 0; // no extended attributes on this file system
+            break;
+        } else if (errno != ERANGE) {
+            return errno;
+        }
+        const ssize_t needed = ::flistxattr(source_fd, nullptr, 0);
+        if (needed == -1) {
+            return errno;
+        }
+        names.resize(needed);
+    }
+
+    std::vector<char> value(4096);
+    for (const char* name = names.data(); name < names.data() + names_length; name += std::strlen(name) + 1) {
+        ssize_t value_length;
+        for (;;) {
+            value_length = ::fgetxattr(source_fd, name, value.data(), value.size());
+            if (value_length >= 0 || errno != ERANGE) {
+                break;
+            }
+            const ssize_t needed = ::fgetxattr(source_fd, name, nullptr, 0);
+            if (needed == -1) {
+                break;
+            }
+            value.resize(needed);
+        }
+        if (value_length == -1) {
+            if (errno == ENODATA) {
+                continue; // removed since it was listed
+            }
+            return errno;
+        }
+        // Unprivileged processes can't set e.g. "trusted." attributes, and
+        // the destination's file system might not support them at all.
+        if (::fsetxattr(destination_fd, name, value.data(), value_length, 0) == -1 &&
+            errno != EPERM && errno != ENOTSUP) {
+            return errno;
+        }
+    }
+
+    if (::fchmod(destination_fd, status.mode & 07777) == -1) {
+        return errno;
+    }
+
+    const timespec times[2] = {
+        {.tv_sec = status.accessed / 1'000'000'000, .tv_nsec = status.accessed % 1'000'000'000},
+        {.tv_sec = status.modified / 1'000'000'000, .tv_nsec = status.modified % 1'000'000'000}};
+    if (::futimens(destination_fd, times) == -1) {
+        return errno;
+    }
+    return 0;
+}
+
+int clone_file(int source_fd, int destination_fd) {
+    if (::ioctl(destination_fd, FICLONE, source_fd) == -1) {
+        return errno;
+    }
+    return 0;
+}
+
+namespace {
+
+// Read whatever zero-copy completion notifications are queued on the socket
+// `fd`, and set `completed` to the number of sends known to be complete.
+// Return zero on success, or return `errno` if an error occurs.
+int reap_zero_copy_completions(int fd, std::uint32_t& completed) {
+    for (;;) {
+        char control[128];
+        msghdr message{};
+        message.msg_control = control;
+        message.msg_controllen = sizeof control;
+        if (::recvmsg(fd, &message, MSG_ERRQUEUE) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : errno;
+        }
+        for (cmsghdr* header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header)) {
+            if (!((header->cmsg_level == SOL_IP && header->cmsg_type == IP_RECVERR) ||
+                  (header->cmsg_level == SOL_IPV6 && header->cmsg_type == IPV6_RECVERR))) {
+                continue;
+            }
+            const auto* error = reinterpret_cast<const sock_extended_err*>(CMSG_DATA(header));
+            if (error->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                return error->ee_errno ? error->ee_errno : EIO;
+            }
+            // Sends are numbered from zero, and each notification covers
+            // the inclusive range [ee_info, ee_data].
+            completed = std::max(completed, error->ee_data + 1);
+        }
+    }
+}
+
+// Send as `send_file` does, but using `MSG_ZEROCOPY`. The kernel reads the
+// pages of the mapped file while sending, so the mapping must outlive every
+// send, which is why this waits for all of them to complete.
+int send_file_zero_copy(int socket_fd, int file_fd, std::size_t count, const CopyOptions& options) {
+    if (count == 0) {
+        return 0;
+    }
+    const auto mapped = memory_map_for_reading(file_fd, count);
+    if (mapped.error) {
+        return mapped.error;
+    }
+    const char* const data = static_cast<const char*>(mapped.address);
+
+    int error = 0;
+    std::uint32_t sent = 0;
+    std::uint32_t completed = 0;
+    std::size_t total = 0;
+    while (total < count && !error) {
+        std::size_t chunk = count - total;
+        if (options.chunk_size) {
+            chunk = std::min(chunk, options.chunk_size);
+        }
+        if (options.before_chunk) {
+            options.before_chunk(chunk);
+        }
+        ssize_t rc;
+        // whether this chunk is sent by copying, which has no completion
+        bool copied = false;
+        for (;;) {
+            rc = ::send(socket_fd, data + total, chunk, copied ? 0 : MSG_ZEROCOPY);
+            if (rc == -1 && errno == ENOBUFS && !copied) {
+                if (completed == sent) {
+                    // No earlier send is pinning memory, so waiting wouldn't
+                    // help. Copy this chunk instead.
+                    copied = true;
+                    continue;
+                }
+                // Too many sends are pinning memory. Wait for some to
+                // finish.
+                pollfd request{.fd = socket_fd, .events = 0, .revents = 0};
+                if (::poll(&request, 1, -1) == -1 && errno != EINTR) {
+                    error = errno;
+                    break;
+                }
+                if ((error = reap_zero_copy_completions(socket_fd, completed))) {
+                    break;
+                }
+            } else if (rc != -1 || errno != EINTR) {
+                break;
+            }
+        }
+        if (error) {
+            break;
+        } else if (rc == -1) {
+            error = errno;
+            break;
+        }
+        if (!copied) {
+            ++sent;
+        }
+        total += rc;
+        if (options.after_chunk) {
+            options.after_chunk(rc);
+        }
+    }
+
+    // Only an error can wake `poll` when no events are requested, and
+    // completion notifications arrive as errors.
+    while (completed < sent && !error) {
+        pollfd request{.fd = socket_fd, .events = 0, .revents = 0};
+        if (::poll(&request, 1, -1) == -1 && errno != EINTR) {
+            error = errno;
+            break;
+        }
+        error = reap_zero_copy_completions(socket_fd, completed);
+    }
+
+    if (const int rc = memory_unmap(mapped.address, count); rc && !error) {
+        error = rc;
+    }
+    return error;
+}
+
+} // namespace
+
+int send_file(int socket_fd, int file_fd, std::size_t count, const CopyOptions& options) {
+    if (options.zero_copy) {
+        const int yes = 1;
+        if (::setsockopt(socket_fd, SOL_SOCKET, SO_ZEROCOPY, &yes, sizeof yes) == 0) {
+            return send_file_zero_copy(socket_fd, file_fd, count, options);
+        }
+        // Unix domain sockets, for example, don't support zero-copy sends.
+        // `sendfile()` doesn't copy either, so use that instead.
+    }
+
+    off_t offset = 0;
+    while (std::size_t(offset) < count) {
+        std::size_t chunk = count - offset;
+        if (options.chunk_size) {
+            chunk = std::min(chunk, options.chunk_size);
+        }
+        if (options.before_chunk) {
+            options.before_chunk(chunk);
+        }
+        const off_t before = offset;
+        ssize_t rc;
+        do {
+            rc = ::sendfile(socket_fd, file_fd, &offset, chunk);
+        } while (rc == -1 && errno == EINTR);
+        if (rc == -1) {
+            return errno;
+        } else if (rc == 0) {
+            return EIO; // the file is shorter than `count`
+        }
+        if (options.after_chunk) {
+            options.after_chunk(offset - before);
+        }
     }
     return 0;
 }
 
+int receive_file(int socket_fd, int file_fd, std::size_t count, const CopyOptions& options) {
+    int pipe_fds[2];
+    if (::pipe(pipe_fds)) {
+        return errno;
+    }
+    const int pipe_read = pipe_fds[0];
+    const int pipe_write = pipe_fds[1];
+    // A bigger pipe means fewer splices. If the system won't allow it, then
+    // the default size will do.
+    const int rc = ::fcntl(pipe_write, F_SETPIPE_SZ, 1024 * 1024);
+    const std::size_t pipe_size = rc == -1 ? 64 * 1024 : rc;
+
+    int error = 0;
+    std::size_t total = 0;
+    while (total < count && !error) {
+        std::size_t chunk = std::min(count - total, pipe_size);
+        if (options.chunk_size) {
+            chunk = std::min(chunk, options.chunk_size);
+        }
+        if (options.before_chunk) {
+            options.before_chunk(chunk);
+        }
+        ssize_t received;
+        do {
+            received = ::splice(socket_fd, nullptr, pipe_write, nullptr, chunk, SPLICE_F_MOVE | SPLICE_F_MORE);
+        } while (received == -1 && errno == EINTR);
+        if (received == -1) {
+            error = errno;
+            break;
+        } else if (received == 0) {
+            error = ECONNRESET;
+            break;
+        }
+        // Drain the pipe into the file before receiving any more.
+        for (ssize_t left = received; left > 0;) {
+            const ssize_t written = ::splice(pipe_read, nullptr, file_fd, nullptr, left, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (written == -1 && errno == EINTR) {
+                continue;
+            } else if (written == -1) {
+                error = errno;
+                break;
+            }
+            left -= written;
+        }
+        if (error) {
+            break;
+        }
+        total += received;
+        if (options.after_chunk) {
+            options.after_chunk(received);
+        }
+    }
+
+    close_file(pipe_read);
+    close_file(pipe_write);
+    return error;
+}
+
 } // namespace posix
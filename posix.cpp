@@ -1,11 +1,20 @@
 #include "posix.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cerrno>
+#include <cstring>
+#include <string_view>
 
+#include <dirent.h>
 #include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 namespace posix {
@@ -40,6 +49,44 @@ int write_all(int fd, const char* source, std::size_t count) {
     return total;
 }
 
+int send_all(int socket_fd, const char* source, std::size_t count) {
+#if defined(__APPLE__)
+    // Darwin has no `MSG_NOSIGNAL`, but this socket option does the same.
+    const int on = 1;
+    if (::setsockopt(socket_fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof on) == -1) {
+        return -errno;
+    }
+    const int flags = 0;
+#else
+    const int flags = MSG_NOSIGNAL;
+#endif
+    std::size_t total = 0;
+    while (total < count) {
+        const ssize_t rc = ::send(socket_fd, source + total, count - total, flags);
+        if (rc == -1 && errno == EINTR) {
+            continue; // interrupted by signal before a byte was sent, try again
+        } else if (rc == -1) {
+            return -errno; // error, return a negative error code
+        }
+        total += rc;
+    }
+    return total;
+}
+
+int write_all_at(int fd, const char* source, std::size_t count, std::size_t offset) {
+    std::size_t total = 0;
+    while (total < count) {
+        const int rc = ::pwrite(fd, source + total, count - total, offset + total);
+        if (rc == -1 && errno == EINTR) {
+            continue; // interrupted by signal before a byte was written, try again
+        } else if (rc == -1) {
+            return -errno; // error, return a negative error code
+        }
+        total += rc;
+    }
+    return total;
+}
+
 int open_for_reading(const char* path) {
     int fd;
     do {
@@ -64,6 +111,44 @@ int open_for_reading_and_writing(const char* path, unsigned mode) {
     return fd  == -1 ? -errno : fd;
 }
 
+int open_for_resuming(const char* path, unsigned mode) {
+    int fd;
+    do {
+        fd = ::open(path, O_RDWR | O_CREAT, static_cast<mode_t>(mode));
+    } while (fd == -1 && errno == EINTR);
+    return fd  == -1 ? -errno : fd;
+}
+
+int open_directory(const char* path) {
+    int fd;
+    do {
+        fd = ::open(path, O_RDONLY | O_DIRECTORY);
+    } while (fd == -1 && errno == EINTR);
+    return fd  == -1 ? -errno : fd;
+}
+
+int list_directory(const char* path, std::vector<std::string>& names) {
+    DIR* const directory = ::opendir(path);
+    if (!directory) {
+        return errno;
+    }
+    int error = 0;
+    for (;;) {
+        errno = 0;
+        const dirent* const entry = ::readdir(directory);
+        if (!entry) {
+            error = errno; // zero at the end of the directory
+            break;
+        }
+        const std::string_view name = entry->d_name;
+        if (name != "." && name != "..") {
+            names.emplace_back(name);
+        }
+    }
+    ::closedir(directory);
+    return error;
+}
+
 void close_file(int fd) {
     int rc;
     do {
@@ -75,9 +160,60 @@ void close_file(int fd) {
 FileStatusResult file_status(int fd) {
     struct stat file_info;
     if (::fstat(fd, &file_info)) {
-        return {.error = errno, .status = {.mode = 0, .size = 0}};
+        return {.error = errno, .status = {.mode = 0, .size = 0, .modified = 0, .device = 0, .accessed = 0, .owner = 0, .group = 0}};
+    }
+#if defined(__APPLE__)
+    const timespec& modified = file_info.st_mtimespec;
+    const timespec& accessed = file_info.st_atimespec;
+#else
+    const timespec& modified = file_info.st_mtim;
+    const timespec& accessed = file_info.st_atim;
+#endif
+    return {.error = 0, .status = {
+        .mode = file_info.st_mode,
+        .size = std::size_t(file_info.st_size),
+        .modified = modified.tv_sec * 1'000'000'000LL + modified.tv_nsec,
+        .device = std::uint64_t(file_info.st_dev),
+        .accessed = accessed.tv_sec * 1'000'000'000LL + accessed.tv_nsec,
+        .owner = file_info.st_uid,
+        .group = file_info.st_gid}};
+}
+
+int seek(int fd, std::size_t offset) {
+    if (::lseek(fd, offset, SEEK_SET) == -1) {
+        return errno;
     }
-    return {.error = 0, .status = {.mode = file_info.st_mode, .size = std::size_t(file_info.st_size)}};
+    return 0;
+}
+
+int truncate_file(int fd, std::size_t size) {
+    int rc;
+    do {
+        rc = ::ftruncate(fd, size);
+    } while (rc == -1 && errno == EINTR);
+    return rc == -1 ? errno : 0;
+}
+
+int sync_file_data(int fd) {
+    int rc;
+    do {
+        rc = ::fdatasync(fd);
+    } while (rc == -1 && errno == EINTR);
+    return rc == -1 ? errno : 0;
+}
+
+int remove_file(const char* path) {
+    if (::unlink(path)) {
+        return errno;
+    }
+    return 0;
+}
+
+int link_file(const char* existing_path, const char* new_path) {
+    if (::link(existing_path, new_path)) {
+        return errno;
+    }
+    return 0;
 }
 
 std::size_t page_size() {
@@ -86,6 +222,35 @@ std::size_t page_size() {
     return rc;
 }
 
+CacheResidency mapped_cache_residency(int fd, std::size_t offset, std::size_t count) {
+    if (count == 0) {
+        return {.error = 0, .cached_pages = 0, .total_pages = 0};
+    }
+    // A mapping must begin on a page boundary.
+    const std::size_t page = page_size();
+    const std::size_t begin = offset / page * page;
+    const std::size_t length = offset + count - begin;
+    void* const address = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, begin);
+    if (address == MAP_FAILED) {
+        return {.error = errno, .cached_pages = 0, .total_pages = 0};
+    }
+    // Darwin's `mincore()` fills `char`s, and Linux's `unsigned char`s.
+#if defined(__APPLE__)
+    std::vector<char> pages((length + page - 1) / page);
+#else
+    std::vector<unsigned char> pages((length + page - 1) / page);
+#endif
+    const int rc = ::mincore(static_cast<char*>(address), length, pages.data());
+    const int error = errno;
+    ::munmap(address, length);
+    if (rc) {
+        return {.error = error, .cached_pages = 0, .total_pages = 0};
+    }
+    // The lowest bit says whether the page is resident.
+    const std::size_t cached = std::count_if(pages.begin(), pages.end(), [](auto flags) { return flags & 1; });
+    return {.error = 0, .cached_pages = cached, .total_pages = pages.size()};
+}
+
 MemoryMapResult memory_map_for_reading(int fd, std::size_t count) {
     const int protection = PROT_READ;
     const int flags = MAP_PRIVATE;
@@ -139,4 +304,159 @@ int memory_unmap(void* address, std::size_t count) {
     return 0;
 }
 
+NumaNodeResult copy_numa_node(int source_fd, int destination_fd) {
+    for (const int fd : {destination_fd, source_fd}) {
+        const NumaNodeResult result = file_numa_node(fd);
+        if (result.error || result.node != -1) {
+            return result;
+        }
+    }
+    // If neither device is nearer to any node, then go wherever we are.
+    return {.error = 0, .node = std::max(0, current_numa_node())};
+}
+
+namespace {
+
+// Fill `address` with the Unix domain socket address `path`. Return zero on
+// success, or return `ENAMETOOLONG` if `path` doesn't fit.
+int unix_socket_address(sockaddr_un& address, const char* path) {
+    address = sockaddr_un{};
+    address.sun_family = AF_UNIX;
+    if (std::strlen(path) >= sizeof address.sun_path) {
+        return ENAMETOOLONG;
+    }
+    std::strcpy(address.sun_path, path);
+    return 0;
+}
+
+} // namespace
+
+int listen_on_unix_socket(const char* path) {
+    sockaddr_un address;
+    if (const int rc = unix_socket_address(address, path)) {
+        return -rc;
+    }
+
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        return -errno;
+    }
+
+    // A previous listener might have left its socket file behind.
+    if (::unlink(path) == -1 && errno != ENOENT) {
+        const int error = errno;
+        close_file(fd);
+        return -error;
+    }
+    // Only our own user may connect. Nobody can connect before `listen()`, so
+    // there's no window in which the socket is more open than that.
+    if (::bind(fd, reinterpret_cast<const sockaddr*>(&address), sizeof address) == -1 ||
+        ::chmod(path, 0600) == -1 ||
+        ::listen(fd, SOMAXCONN) == -1) {
+        const int error = errno;
+        close_file(fd);
+        return -error;
+    }
+    return fd;
+}
+
+int connect_to_unix_socket(const char* path) {
+    sockaddr_un address;
+    if (const int rc = unix_socket_address(address, path)) {
+        return -rc;
+    }
+
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        return -errno;
+    }
+
+    // Don't retry on `EINTR`: the connection would then be completing
+    // asynchronously, and a second `connect` would fail.
+    if (::connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof address) == -1) {
+        const int error = errno;
+        close_file(fd);
+        return -error;
+    }
+    return fd;
+}
+
+namespace {
+
+// Call `attempt` with each address of `host` and `port` until it returns a
+// file descriptor, and return that, or else return `-errno` of the last
+// failure.
+template <typename Attempt>
+int for_each_tcp_address(const char* host, const char* port, int flags, Attempt attempt) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = flags;
+    addrinfo* addresses;
+    if (const int rc = ::getaddrinfo(host, port, &hints, &addresses)) {
+        return rc == EAI_SYSTEM ? -errno : -EADDRNOTAVAIL;
+    }
+    int result = -EADDRNOTAVAIL;
+    for (const addrinfo* address = addresses; address; address = address->ai_next) {
+        const int fd = ::socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (fd == -1) {
+            result = -errno;
+            continue;
+        }
+        if (attempt(fd, *address)) {
+            result = -errno;
+            close_file(fd);
+            continue;
+        }
+        result = fd;
+        break;
+    }
+    ::freeaddrinfo(addresses);
+    return result;
+}
+
+} // namespace
+
+int listen_on_tcp(const char* host, const char* port) {
+    return for_each_tcp_address(host, port, AI_PASSIVE, [](int fd, const addrinfo& address) {
+        // Allow a new listener right after the last one exits.
+        const int yes = 1;
+        return ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof yes) == -1 ||
+               ::bind(fd, address.ai_addr, address.ai_addrlen) == -1 ||
+               ::listen(fd, SOMAXCONN) == -1;
+    });
+}
+
+int connect_to_tcp(const char* host, const char* port) {
+    return for_each_tcp_address(host, port, 0, [](int fd, const addrinfo& address) {
+        // As in `connect_to_unix_socket`, don't retry on `EINTR`.
+        return ::connect(fd, address.ai_addr, address.ai_addrlen) == -1;
+    });
+}
+
+int accept_connection(int fd) {
+    int connection;
+    do {
+        connection = ::accept(fd, nullptr, nullptr);
+    } while (connection == -1 && errno == EINTR);
+    return connection == -1 ? -errno : connection;
+}
+
+int wait_for_input(int fd, int timeout_millis) {
+    pollfd request{.fd = fd, .events = POLLIN, .revents = 0};
+    const int rc = ::poll(&request, 1, timeout_millis);
+    if (rc == -1 && errno == EINTR) {
+        return 0; // interrupted by signal, so treat it like a timeout
+    }
+    return rc == -1 ? -errno : rc;
+}
+
+PageFaults page_faults() {
+    struct rusage usage;
+    if (::getrusage(RUSAGE_SELF, &usage) == -1) {
+        return {.error = errno, .minor = 0, .major = 0};
+    }
+    return {.error = 0, .minor = std::uint64_t(usage.ru_minflt), .major = std::uint64_t(usage.ru_majflt)};
+}
+
 } // namespace posix
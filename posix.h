@@ -1,6 +1,10 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
 
 namespace posix {
 
@@ -17,6 +21,18 @@ int read_all(int fd, char* destination, std::size_t count);
 // occurs, such as if the destination file becomes full.
 int write_all(int fd, const char* source, std::size_t count);
 
+// Send `count` bytes from the buffer referred to by `source` over the
+// connected stream socket `socket_fd`, as `write_all` does, except that a peer
+// that has gone away makes this return `-EPIPE` rather than raising `SIGPIPE`.
+int send_all(int socket_fd, const char* source, std::size_t count);
+
+// Write into the file associated with the file descriptor, `fd`, `count` bytes
+// from the buffer referred to by `source`, beginning at `offset` bytes from the
+// beginning of the file. The file offset of `fd` is not changed, so multiple
+// threads may write different parts of the file at once. Return `count` on
+// success, or return `-errno` if an error occurs.
+int write_all_at(int fd, const char* source, std::size_t count, std::size_t offset);
+
 // Open the existing file indicated by its `path` on the file system and return
 // a file descriptor to that file open for reading. Return `-errno` if an error
 // occurs.
@@ -35,12 +51,39 @@ int open_for_writing(const char* path, unsigned mode);
 // occurs.
 int open_for_reading_and_writing(const char* path, unsigned mode);
 
+// Open or create a file indicated by its `path` on the file system and return
+// a file descriptor to that file open for reading and writing. If the file
+// already exists, then do not truncate its contents. If the file does not
+// already exist, then create it with `mode` (permissions). Return `-errno` if
+// an error occurs.
+int open_for_resuming(const char* path, unsigned mode);
+
+// Open the existing directory indicated by its `path` on the file system and
+// return a file descriptor to that directory, suitable for use as the `dirfd`
+// argument of the "*at" family of functions. Return `-errno` if an error
+// occurs.
+int open_directory(const char* path);
+
+// Append to `names` the name of every entry in the directory indicated by its
+// `path` on the file system, other than "." and "..", in unspecified order.
+// Return zero on success, or return `errno` if an error occurs.
+int list_directory(const char* path, std::vector<std::string>& names);
+
 // Close the file associated with the file descriptor, `fd`.
 void close_file(int fd);
 
 struct FileStatus {
     unsigned mode;
     std::size_t size;
+    // time of last modification, in nanoseconds since the Unix epoch
+    std::int64_t modified;
+    // identifies the device that stores the file
+    std::uint64_t device;
+    // time of last access, in nanoseconds since the Unix epoch
+    std::int64_t accessed;
+    // user ID and group ID of the file's owner
+    unsigned owner;
+    unsigned group;
 };
 
 struct FileStatusResult {
@@ -53,9 +96,73 @@ struct FileStatusResult {
 // `{.error=errno, ...}` if an error occurs.
 FileStatusResult file_status(int fd);
 
+// Move the file offset of the file descriptor, `fd`, to `offset` bytes from
+// the beginning of the file. Return zero on success, or return `errno` if an
+// error occurs.
+int seek(int fd, std::size_t offset);
+
+// Set the size of the file associated with the file descriptor, `fd`, to
+// `size` bytes, discarding any beyond. Return zero on success, or return
+// `errno` if an error occurs.
+int truncate_file(int fd, std::size_t size);
+
+// Commit to storage the data written to the file associated with the file
+// descriptor, `fd`, together with any metadata needed to read it back, and
+// wait for the I/O to finish. Return zero on success, or return `errno` if an
+// error occurs.
+int sync_file_data(int fd);
+
+// Remove the file indicated by its `path` on the file system. Return zero on
+// success, or return `errno` if an error occurs.
+int remove_file(const char* path);
+
+// Give the existing file indicated by its path `existing_path` on the file
+// system another name, `new_path` (a hard link). Return zero on success, or
+// return `errno` if an error occurs.
+int link_file(const char* existing_path, const char* new_path);
+
 // Return the size of a memory page, in bytes.
 std::size_t page_size();
 
+struct CacheResidency {
+    int error;
+    // pages of the range that are in the page cache
+    std::size_t cached_pages;
+    // pages that the range overlaps
+    std::size_t total_pages;
+};
+
+// Return how many of the pages of the file associated with the file descriptor
+// `fd` that overlap the `count` bytes beginning at `offset` are in the page
+// cache. Return `{.error=0, ...}` on success, or return `{.error=errno, ...}`
+// if an error occurs. On Linux, this uses `cachestat()` (Linux 6.5 and later)
+// if it can, and otherwise `mapped_cache_residency`.
+CacheResidency cache_residency(int fd, std::size_t offset, std::size_t count);
+
+// Do what `cache_residency` does by mapping the range into memory and calling
+// `mincore()`, which works anywhere but costs more. `fd` must be open for
+// reading.
+CacheResidency mapped_cache_residency(int fd, std::size_t offset, std::size_t count);
+
+// Advise that the file associated with the file descriptor `fd` will be read
+// sequentially, so that the kernel reads further ahead. Return zero on
+// success, or return `errno` if an error occurs.
+int advise_sequential(int fd);
+
+// Begin writing to storage the modified pages of the file associated with the
+// file descriptor `fd` among the `count` bytes beginning at `offset`, without
+// waiting for them. Return zero on success, or return `errno` if an error
+// occurs. On Darwin, this does nothing.
+int start_writeback(int fd, std::size_t offset, std::size_t count);
+
+// Remove from the page cache the whole pages of the file associated with the
+// file descriptor `fd` among the `count` bytes beginning at `offset`. Modified
+// pages are written to storage first, since they can't be removed until
+// they're clean. Return zero on success, or return `errno` if an error occurs.
+// On Darwin, which can only stop caching a file altogether (`F_NOCACHE`), this
+// does nothing.
+int drop_cached(int fd, std::size_t offset, std::size_t count);
+
 struct MemoryMapResult {
     int error;
     void* address;
@@ -89,11 +196,173 @@ int memory_sync(void* address, std::size_t count);
 // `errno` if an error occurs.
 int memory_unmap(void* address, std::size_t count);
 
+// Return whether the file associated with the file descriptor, `fd`, resides
+// on a memory-backed file system, such as tmpfs, where the file's contents are
+// never written to a storage device. Return `1` if so, `0` if not, or return
+// `-errno` if an error occurs.
+int file_system_is_memory(int fd);
+
+// Advise the operating system that the mapped memory region beginning at
+// `address` and having length `count` bytes would benefit from being backed by
+// huge pages. The advice may be ignored. Return zero on success, or return
+// `errno` if an error occurs.
+int memory_advise_huge_pages(void* address, std::size_t count);
+
+struct NumaNodeResult {
+    int error;
+    // -1 means that there's no particular node
+    int node;
+};
+
+// Get the NUMA node nearest to the block device that stores the file
+// associated with the file descriptor `fd`. Return `{.error=0, .node=node}` on
+// success, where `node` is -1 if the file is not stored on a block device or if
+// the device is not nearer to any node than to another. Return
+// `{.error=errno, .node=-1}` if an error occurs.
+NumaNodeResult file_numa_node(int fd);
+
+// Return the NUMA node of the CPU on which the calling thread is running, or
+// return `-errno` if an error occurs.
+int current_numa_node();
+
+// Choose the NUMA node on which to copy from the file associated with
+// `source_fd` to the file associated with `destination_fd`: the node nearest
+// the destination's block device, or else the source's, or else the node on
+// which the calling thread is running. Return `{.error=0, .node=node}` on
+// success, or return `{.error=errno, .node=-1}` if an error occurs.
+NumaNodeResult copy_numa_node(int source_fd, int destination_fd);
+
+// Restrict the calling thread to run only on the CPUs of NUMA node `node`.
+// Return zero on success, or return `errno` if an error occurs.
+int bind_thread_to_numa_node(int node);
+
+// Allocate a region of readable and writable memory `count` bytes in size
+// whose pages are preferentially placed on NUMA node `node`, and touch every
+// page so that none are placed later by whichever thread touches them first.
+// On success, return `{.error=0, .address=address, .fd=-1}`, or return
+// `{.error=errno, .address=nullptr, .fd=-1}` if an error occurs. Release the
+// memory using `memory_unmap`.
+MemoryMapResult allocate_on_numa_node(std::size_t count, int node);
+
+enum class IoClass {
+    // share the device fairly with other best-effort I/O, at a `level` from 0
+    // (highest) to 7 (lowest)
+    BEST_EFFORT,
+    // use the device only when nobody else is
+    IDLE
+};
+
+// Set the I/O scheduling class of the calling process to `io_class`, and its
+// priority within the class to `level` if the class has levels. Return zero on
+// success, or return `errno` if an error occurs.
+int set_io_priority(IoClass io_class, int level);
+
+// Create a stream socket bound to the Unix domain socket address `path` and
+// listening for connections. If a file already exists at `path`, remove it
+// first. Only processes of the same user may connect. Return a file
+// descriptor to the socket, or return `-errno` if an error occurs.
+int listen_on_unix_socket(const char* path);
+
+// Connect a new stream socket to the listening Unix domain socket at `path`.
+// Return a file descriptor to the connected socket, or return `-errno` if an
+// error occurs.
+int connect_to_unix_socket(const char* path);
+
+// Create a TCP socket bound to `port` (a number or service name) on the
+// address `host`, which may be a name or a numeric IPv4 or IPv6 address, and
+// listening for connections. Return a file descriptor to the socket, or return
+// `-errno` if an error occurs. If `host` can't be resolved, the error is
+// `EADDRNOTAVAIL`.
+int listen_on_tcp(const char* host, const char* port);
+
+// Connect a new TCP socket to `port` on `host`, trying each of the host's
+// addresses in turn. Return a file descriptor to the connected socket, or
+// return `-errno` if an error occurs. If `host` can't be resolved, the error
+// is `EADDRNOTAVAIL`.
+int connect_to_tcp(const char* host, const char* port);
+
+// Wait for and accept a connection on the listening socket `fd`. Return a file
+// descriptor to the connected socket, or return `-errno` if an error occurs.
+int accept_connection(int fd);
+
+// Wait at most `timeout_millis` milliseconds for the file descriptor `fd` to
+// have input, or, for a listening socket, a connection. Return `1` if it does,
+// `0` if the time ran out first, or return `-errno` if an error occurs.
+int wait_for_input(int fd, int timeout_millis);
+
+struct PageFaults {
+    int error;
+    // faults served without I/O
+    std::uint64_t minor;
+    // faults that needed I/O
+    std::uint64_t major;
+};
+
+// Get the number of page faults of the calling process so far. Return
+// `{.error=0, ...}` on success, or return `{.error=errno, ...}` if an error
+// occurs.
+PageFaults page_faults();
+
+struct CopyOptions {
+    // the most bytes to copy per system call, or zero for no limit
+    std::size_t chunk_size = 0;
+    // If not empty, called with the size of each chunk before copying it.
+    std::function<void(std::size_t)> before_chunk;
+    // If not empty, called with the number of bytes copied after each chunk.
+    std::function<void(std::size_t)> after_chunk;
+    // For `send_file` to a TCP socket on Linux, send from the file mapped
+    // into memory using `MSG_ZEROCOPY` instead of using `sendfile()`.
+    bool zero_copy = false;
+    // For `copy_all` on Linux, also copy the source's metadata, as
+    // `copy_metadata` does. On Darwin, `copy_all` always does.
+    bool preserve = false;
+    // For `copy_all` on Linux, if not zero, keep at most about this many bytes
+    // of each file cached behind the copy, using a `CacheWindow` (see
+    // cache.h). Chunks are then at most a quarter of this.
+    std::size_t cache_window = 0;
+};
+
 // Copy the contents of the file indicated by its path `source_path` into the
 // file indicated by its path `destination_path`, creating the destination file
 // if necessary. Return zero on success, or return `errno` if an error occurs.
 // Note that there is a possibility that more than zero bytes may be copied
-// when an error occurs, such as if the destination file becomes full.
-int copy_all(const char* source_path, const char* destination_path);
+// when an error occurs, such as if the destination file becomes full. On
+// Darwin, the whole file is always one chunk.
+int copy_all(const char* source_path, const char* destination_path, const CopyOptions& options = {});
+
+// Copy the metadata of the file associated with the file descriptor
+// `source_fd`, whose status is `status`, to the file associated with the file
+// descriptor `destination_fd`: its extended attributes (which, on Linux,
+// include ACLs), ownership, permissions, and access and modification times.
+// Call this after writing the destination's contents, since writing updates
+// the modification time. Only file descriptors are used, so no path is looked
+// up again. Attributes or ownership that the caller isn't permitted to set, or
+// that the destination's file system doesn't support, are skipped. Return
+// zero on success, or return `errno` if an error occurs.
+int copy_metadata(int source_fd, const FileStatus& status, int destination_fd);
+
+// Make the file associated with the file descriptor `destination_fd` share the
+// contents of the file associated with the file descriptor `source_fd` (a
+// "reflink"), so that no data is copied until one of them is modified. Return
+// zero on success, or return `errno` if an error occurs. On Linux, this is the
+// `FICLONE` ioctl, which fails with `EOPNOTSUPP`, `EXDEV`, or `EINVAL` if the
+// file system (e.g. ext4) can't share data between these files. On Darwin,
+// it always fails with `ENOTSUP`.
+int clone_file(int source_fd, int destination_fd);
+
+// Send the first `count` bytes of the file associated with the file
+// descriptor `file_fd` to the connected stream socket `socket_fd`. Return zero
+// on success, or return `errno` if an error occurs. On Linux, this uses
+// `sendfile()`, or `MSG_ZEROCOPY` if requested and the socket supports it. On
+// Darwin, it reads and writes.
+int send_file(int socket_fd, int file_fd, std::size_t count, const CopyOptions& options = {});
+
+// Receive `count` bytes from the connected stream socket `socket_fd` and write
+// them to the file associated with the file descriptor `file_fd` at its
+// current offset. Return zero on success, or return `errno` if an error
+// occurs. If the peer disconnects early, the error is `ECONNRESET`. On Linux,
+// this uses `splice()` through a pipe, so the data isn't copied into this
+// process. On Darwin, it reads and writes.
+int receive_file(int socket_fd, int file_fd, std::size_t count, const CopyOptions& options = {});
 
 } // namespace posix
@@ -1,8 +1,16 @@
+#include "autotune.h"
+#include "cache.h"
+#include "checksum.h"
+#include "journal.h"
+#include "metrics.h"
 #include "posix.h"
+#include "throttle.h"
 
+#include <chrono>
 #include <cstring>
 #include <exception>
 #include <iostream>
+#include <optional>
 #include <ostream>
 #include <string>
 #include <string_view>
@@ -13,6 +21,22 @@ struct Options {
     std::string source;
     std::string destination;
     std::size_t buffer_size = posix::page_size();
+    bool auto_buffer = false;
+    // where to remember tuned buffer sizes, if anywhere
+    std::string buffer_cache;
+    bool numa = false;
+    // -1 means the node nearest the destination's (or else the source's) device
+    int numa_node = -1;
+    ThrottleOptions throttle;
+    bool set_io_priority = false;
+    posix::IoClass io_class = posix::IoClass::BEST_EFFORT;
+    int io_level = 4;
+    bool resume = false;
+    std::size_t journal_interval = 64 * 1024 * 1024;
+    MetricsOptions metrics;
+    bool preserve = false;
+    bool cache_neutral = false;
+    std::size_t cache_window = 16 * 1024 * 1024;
 };
 
 void usage(std::string_view name, std::ostream& out);
@@ -27,6 +51,13 @@ int main(int argc, char* argv[]) {
         return 0; // `parse_command_line` printed the usage already
     }
 
+    if (options.set_io_priority) {
+        if (const int rc = posix::set_io_priority(options.io_class, options.io_level)) {
+            std::cerr << "Unable to set I/O priority: " << std::strerror(rc) << '\n';
+            return 1;
+        }
+    }
+
     class Closer {
         int fd;
      public:
@@ -49,44 +80,301 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    const int destination_fd = posix::open_for_writing(options.destination.c_str(), status.mode);
+    // Look at the destination before it's truncated.
+    std::optional<CacheReport> cache_report;
+    if (options.cache_neutral) {
+        cache_report.emplace(options.source, options.destination);
+    }
+
+    const int destination_fd = options.resume
+        ? posix::open_for_resuming(options.destination.c_str(), status.mode)
+        : posix::open_for_writing(options.destination.c_str(), status.mode);
     if (destination_fd < 0) {
         std::cerr << "Unable to open or create \"" << options.destination << "\" for writing: " << std::strerror(-destination_fd) << '\n';
         return 1;
     }
     Closer destination_closer{destination_fd};
 
-    std::vector<char> buffer(options.buffer_size);
+    // With `--buffer auto`, the buffer is as large as it might need to be, and
+    // the tuner decides how much of it to use.
+    std::size_t tuned_size = 0;
+    if (options.auto_buffer) {
+        options.buffer_size = BufferTuner::max_size;
+        if (!options.buffer_cache.empty()) {
+            const auto [error, destination_status] = posix::file_status(destination_fd);
+            if (error) {
+                std::cerr << "Unable to determine the device of \"" << options.destination << "\": " << std::strerror(error) << '\n';
+                return 1;
+            }
+            tuned_size = load_tuned_size(options.buffer_cache, status.device, destination_status.device);
+            if (tuned_size) {
+                options.buffer_size = tuned_size;
+            }
+        }
+    }
+    BufferTuner tuner{options.auto_buffer ? tuned_size : options.buffer_size};
+
+    class Unmapper {
+        void *address;
+        std::size_t count;
+     public:
+        Unmapper(void* address, std::size_t count) : address(address), count(count) {}
+        ~Unmapper() {
+            if (const int rc = posix::memory_unmap(address, count)) {
+                std::cerr << "Failed to unmap buffer memory: " << std::strerror(rc) << '\n';
+            }
+        }
+    };
+
+    std::vector<char> heap_buffer;
+    std::optional<Unmapper> buffer_unmapper;
+    char* buffer;
+    if (options.numa) {
+        if (options.numa_node == -1) {
+            const auto [error, node] = posix::copy_numa_node(source_fd, destination_fd);
+            if (error) {
+                std::cerr << "Unable to determine the NUMA node of a file's device: " << std::strerror(error) << '\n';
+                return 1;
+            }
+            options.numa_node = node;
+        }
+        if (const int rc = posix::bind_thread_to_numa_node(options.numa_node)) {
+            std::cerr << "Unable to run on NUMA node " << options.numa_node << ": " << std::strerror(rc) << '\n';
+            return 1;
+        }
+        const auto allocation = posix::allocate_on_numa_node(options.buffer_size, options.numa_node);
+        if (allocation.error) {
+            std::cerr << "Unable to allocate buffer on NUMA node " << options.numa_node << ": " << std::strerror(allocation.error) << '\n';
+            return 1;
+        }
+        buffer_unmapper.emplace(allocation.address, options.buffer_size);
+        buffer = static_cast<char*>(allocation.address);
+    } else {
+        heap_buffer.resize(options.buffer_size);
+        buffer = heap_buffer.data();
+    }
+
+    // With `--resume`, `offset` is where this run began, and then where the
+    // chunk not yet recorded in the journal begins.
+    std::optional<Journal> journal;
+    std::size_t offset = 0;
+    std::size_t chunk_length = 0;
+    std::uint32_t chunk_checksum = 0;
+    if (options.resume) {
+        journal.emplace(options.destination + ".journal");
+        const JournalHeader header{.source_size = status.size, .source_modified = status.modified};
+        if (const int rc = journal->open(header, destination_fd, offset)) {
+            std::cerr << "Unable to open the journal for \"" << options.destination << "\": " << std::strerror(rc) << '\n';
+            return 1;
+        }
+        for (const int fd : {source_fd, destination_fd}) {
+            if (const int rc = posix::seek(fd, offset)) {
+                std::cerr << "Unable to resume at offset " << offset << ": " << std::strerror(rc) << '\n';
+                return 1;
+            }
+        }
+    }
+
+    Metrics metrics{options.metrics};
+    ThreadCounters* counters = nullptr;
+    if (metrics.enabled()) {
+        if (const int rc = metrics.start()) {
+            std::cerr << "Unable to export metrics: " << std::strerror(rc) << '\n';
+            return 1;
+        }
+        counters = &metrics.thread_counters();
+    }
+
+    // `offset` moves as the journal is updated, but the window needs to know
+    // where the file offset is.
+    const std::size_t first_offset = offset;
+    std::optional<CacheWindow> cache_window;
+    if (options.cache_neutral) {
+        cache_window.emplace(source_fd, destination_fd, options.cache_window, first_offset);
+        if (const int rc = cache_window->start(status.size)) {
+            std::cerr << "Unable to advise sequential reading of \"" << options.source << "\": " << std::strerror(rc) << '\n';
+            return 1;
+        }
+    }
+
+    Throttle throttle{options.throttle};
+    const auto before = std::chrono::steady_clock::now();
+    std::size_t total = 0;
     for (;;) {
-        const int count = posix::read_all(source_fd, buffer.data(), buffer.size());
+        // A rate limit caps each read, so that one buffer doesn't use up more
+        // than the burst allowance.
+        const std::size_t chunk_size = throttle.suggested_chunk_size(tuner.size());
+        if (throttle.enabled()) {
+            throttle.acquire(chunk_size);
+        }
+        const auto read_began = std::chrono::steady_clock::now();
+        const int count = posix::read_all(source_fd, buffer, chunk_size);
         if (count < 0) {
             std::cerr << "read error: " << std::strerror(-count) << '\n';
             return 1;
         }
+        if (counters) {
+            counters->add(Counter::READ_CALLS, 1);
+        }
         if (count == 0) {
             // end of input file: we're done
             break;
         }
-        const int rc = posix::write_all(destination_fd, buffer.data(), count);
+        const auto write_began = std::chrono::steady_clock::now();
+        const int rc = posix::write_all(destination_fd, buffer, count);
         if (rc < 0) {
             std::cerr << "write error: " << std::strerror(-rc) << '\n';
             return 1;
         }
+        const auto write_ended = std::chrono::steady_clock::now();
+        if (counters) {
+            counters->add(Counter::WRITE_CALLS, 1);
+            counters->add(Counter::BYTES_COPIED, count);
+        }
+        if (throttle.enabled()) {
+            throttle.observe(write_ended - write_began);
+        }
+        // A capped read says nothing about the buffer size being tuned.
+        if (!tuner.settled() && chunk_size == tuner.size()) {
+            tuner.observe(count, write_ended - read_began);
+            if (tuner.settled() && !options.buffer_cache.empty()) {
+                // Tuning finished, so there's a tuned size to remember. Don't
+                // fail the copy if it can't be remembered.
+                const auto [error, destination_status] = posix::file_status(destination_fd);
+                if (error == 0) {
+                    if (const int rc = store_tuned_size(options.buffer_cache, status.device, destination_status.device, tuner.size())) {
+                        std::cerr << "Unable to update \"" << options.buffer_cache << "\": " << std::strerror(rc) << '\n';
+                    }
+                }
+            }
+        }
+        total += count;
+
+        if (cache_window) {
+            if (const int rc = cache_window->after_chunk(first_offset + total)) {
+                std::cerr << "Unable to drop copied pages from the page cache: " << std::strerror(rc) << '\n';
+                return 1;
+            }
+        }
+
+        if (journal) {
+            chunk_checksum = checksum::crc32c(buffer, count, chunk_checksum);
+            chunk_length += count;
+            if (chunk_length < options.journal_interval) {
+                continue;
+            }
+            // The chunk must be durable before the journal says so.
+            if (const int rc = posix::sync_file_data(destination_fd)) {
+                std::cerr << "Unable to sync \"" << options.destination << "\": " << std::strerror(rc) << '\n';
+                return 1;
+            }
+            if (const int rc = journal->record(offset, chunk_length, chunk_checksum)) {
+                std::cerr << "Unable to update the journal for \"" << options.destination << "\": " << std::strerror(rc) << '\n';
+                return 1;
+            }
+            offset += chunk_length;
+            chunk_length = 0;
+            chunk_checksum = 0;
+        }
+    }
+
+    if (journal) {
+        // The destination might have been longer than the source, e.g. if
+        // the journal was stale. Only once everything is durable is the
+        // journal no longer needed.
+        if (const int rc = posix::truncate_file(destination_fd, offset + chunk_length)) {
+            std::cerr << "Unable to truncate \"" << options.destination << "\": " << std::strerror(rc) << '\n';
+            return 1;
+        }
+        if (const int rc = posix::sync_file_data(destination_fd)) {
+            std::cerr << "Unable to sync \"" << options.destination << "\": " << std::strerror(rc) << '\n';
+            return 1;
+        }
+        if (const int rc = journal->finish()) {
+            std::cerr << "Unable to remove the journal for \"" << options.destination << "\": " << std::strerror(rc) << '\n';
+            return 1;
+        }
+    }
+
+    if (cache_window) {
+        if (const int rc = cache_window->finish(first_offset + total)) {
+            std::cerr << "Unable to drop copied pages from the page cache: " << std::strerror(rc) << '\n';
+            return 1;
+        }
+    }
+
+    // The metadata goes last, since writing changes the modification time.
+    if (options.preserve) {
+        if (const int rc = posix::copy_metadata(source_fd, status, destination_fd)) {
+            std::cerr << "Unable to copy the metadata of \"" << options.source << "\" to \"" << options.destination << "\": " << std::strerror(rc) << '\n';
+            return 1;
+        }
+    }
+
+    if (options.numa) {
+        const auto after = std::chrono::steady_clock::now();
+        // Standard output might be mixed with `jsontime`'s, so report on
+        // standard error.
+        std::cerr << "{\"numa_node\": " << options.numa_node << ", \"bytes\": " << total
+                  << ", \"micros\": " << std::chrono::duration_cast<std::chrono::microseconds>(after - before).count() << "}\n";
+    }
+
+    if (cache_report) {
+        cache_report->print(options.cache_window, std::cerr);
+    }
+
+    if (counters) {
+        counters->add(Counter::FILES_COPIED, 1);
+        // The copy succeeded, so don't fail it over the last export.
+        if (const int rc = metrics.stop()) {
+            std::cerr << "Unable to write metrics to \"" << options.metrics.path << "\": " << std::strerror(rc) << '\n';
+        }
     }
 }
 
 void usage(std::string_view program_name, std::ostream& out) {
     out << "usage:\n\n"
-        "    " << program_name << " [--help | -h] [--buffer BUFSIZE] <source file> <destination file>\n\n"
+        "    " << program_name << " [--help | -h] [--buffer BUFSIZE [--buffer-cache PATH]] [--numa auto | --numa NODE]\n"
+        "        [--rate BYTES] [--iops COUNT] [--adaptive] [--ioprio CLASS] [--resume [--journal-interval BYTES]]\n"
+        "        [--metrics DEST [--metrics-interval MILLIS]] [--preserve] [--cache-neutral [--cache-window BYTES]]\n"
+        "        <source file> <destination file>\n\n"
         "        --help or -h prints this message.\n"
-        "        BUFSIZE is the read/write buffer size in bytes. It defaults to one page.\n"
+        "        BUFSIZE is the read/write buffer size in bytes. It defaults to one page. If it's \"auto\", then\n"
+        "            try increasing sizes during the beginning of the copy, and settle on the fastest.\n"
+        "        PATH is a file in which to remember the buffer size chosen by \"auto\" for the source and\n"
+        "            destination devices, so that later copies between them needn't choose again.\n"
+        "        --numa runs on, and allocates the buffer on, NUMA NODE. \"auto\" chooses the node nearest\n"
+        "            the destination's storage device, or else the source's. The achieved bandwidth is\n"
+        "            printed to standard error.\n"
+        "        BYTES is the most bytes to copy per second. By default, there's no limit.\n"
+        "        COUNT is the most read/write pairs per second. By default, there's no limit.\n"
+        "        --adaptive halves the rate whenever write latency rises, and then recovers gradually.\n"
+        "            BYTES is then the greatest rate. It requires --rate.\n"
+        "        CLASS is the I/O scheduling class: \"idle\", \"best-effort\", or \"best-effort:LEVEL\",\n"
+        "            where LEVEL is 0 (highest) to 7 (lowest). By default, it's inherited.\n"
+        "        --resume keeps a journal of the progress of the copy in \"<destination file>.journal\". If the\n"
+        "            copy is interrupted, then running it again with --resume continues where it left off.\n"
+        "        --journal-interval is how many bytes to copy between journal updates. It defaults to 67108864\n"
+        "            (64 mebibytes).\n"
+        "        --metrics exports live metrics in the OpenMetrics text format to DEST, which is either a file,\n"
+        "            replaced every MILLIS milliseconds (default 1000) and at the end, or \"unix:PATH\", a Unix\n"
+        "            domain socket that sends the metrics to each client that connects.\n"
+        "        --preserve copies the source's extended attributes (including ACLs), ownership, permissions,\n"
+        "            and timestamps to the destination.\n"
+        "        --cache-neutral keeps the copy from filling the page cache: the source is read with a\n"
+        "            sequential readahead hint, and pages of both files more than a window behind the copy\n"
+        "            are dropped, except parts of the source that were cached already. How much of each\n"
+        "            file was cached before and after is printed to standard error. Pages are only\n"
+        "            dropped on Linux.\n"
+        "        --cache-window is how many bytes of each file may stay cached behind the copy. It defaults\n"
+        "            to 16777216 (16 mebibytes).\n"
         "        <source file> is the path to the input file, to be read from.\n"
         "        <destination file> is the path to the output file, to be created/truncated and written to.\n";
 }
 
 int parse_command_line(Options& options, int argc, char* argv[], std::ostream& out, std::ostream& error) {
     const std::string_view program_name =  argv[0];
-    if (argc < 1 + 1 || argc > 1 + 1 + 2 + 2) {
+    if (argc < 1 + 1 || argc > 1 + 1 + 2 + 2 + 2 + 2 + 2 + 1 + 2 + 1 + 2 + 2 + 2 + 2 + 1 + 1 + 2) {
         usage(program_name, error);
         return 1;
     }
@@ -104,9 +392,13 @@ int parse_command_line(Options& options, int argc, char* argv[], std::ostream& o
             ++argv;
             if (!*argv) {
                 usage(program_name, error);
-                error << "\nerror: --buffer requires an integer argument.\n";
+                error << "\nerror: --buffer requires an integer argument or \"auto\".\n";
                 return 1;
             }
+            if (std::string_view(*argv) == "auto") {
+                options.auto_buffer = true;
+                continue;
+            }
             long long value;
             try {
                 value = std::stoll(*argv);
@@ -121,6 +413,163 @@ int parse_command_line(Options& options, int argc, char* argv[], std::ostream& o
                 return 1;
             }
             options.buffer_size = value;
+            options.auto_buffer = false;
+        } else if (arg == "--buffer-cache") {
+            ++argv;
+            if (!*argv) {
+                usage(program_name, error);
+                error << "\nerror: --buffer-cache requires a path argument.\n";
+                return 1;
+            }
+            options.buffer_cache = *argv;
+        } else if (arg == "--numa") {
+            ++argv;
+            if (!*argv) {
+                usage(program_name, error);
+                error << "\nerror: --numa requires an argument.\n";
+                return 1;
+            }
+            options.numa = true;
+            if (std::string_view(*argv) == "auto") {
+                options.numa_node = -1;
+                continue;
+            }
+            long long value;
+            try {
+                value = std::stoll(*argv);
+            } catch (const std::exception&) {
+                usage(program_name, error);
+                error << "\nerror: \"" << *argv << "\" is not a valid argument for --numa\n";
+                return 1;
+            }
+            if (value < 0 || value >= 1024) {
+                usage(program_name, error);
+                error << "\nerror: --numa node must be between 0 and 1023.\n";
+                return 1;
+            }
+            options.numa_node = value;
+        } else if (arg == "--rate" || arg == "--iops") {
+            ++argv;
+            if (!*argv) {
+                usage(program_name, error);
+                error << "\nerror: " << arg << " requires an integer argument.\n";
+                return 1;
+            }
+            long long value;
+            try {
+                value = std::stoll(*argv);
+            } catch (const std::exception&) {
+                usage(program_name, error);
+                error << "\nerror: \"" << *argv << "\" is not a valid integer argument for " << arg << '\n';
+                return 1;
+            }
+            if (value < 1) {
+                usage(program_name, error);
+                error << "\nerror: " << arg << " argument must be at least 1.\n";
+                return 1;
+            }
+            (arg == "--rate" ? options.throttle.bytes_per_second : options.throttle.operations_per_second) = value;
+        } else if (arg == "--resume") {
+            options.resume = true;
+        } else if (arg == "--preserve") {
+            options.preserve = true;
+        } else if (arg == "--cache-neutral") {
+            options.cache_neutral = true;
+        } else if (arg == "--cache-window") {
+            ++argv;
+            if (!*argv) {
+                usage(program_name, error);
+                error << "\nerror: --cache-window requires an integer argument.\n";
+                return 1;
+            }
+            long long value;
+            try {
+                value = std::stoll(*argv);
+            } catch (const std::exception&) {
+                usage(program_name, error);
+                error << "\nerror: \"" << *argv << "\" is not a valid integer argument for --cache-window\n";
+                return 1;
+            }
+            if (value < 65536) {
+                usage(program_name, error);
+                error << "\nerror: --cache-window argument must be at least 65536.\n";
+                return 1;
+            }
+            options.cache_window = value;
+        } else if (arg == "--journal-interval") {
+            ++argv;
+            if (!*argv) {
+                usage(program_name, error);
+                error << "\nerror: --journal-interval requires an integer argument.\n";
+                return 1;
+            }
+            long long value;
+            try {
+                value = std::stoll(*argv);
+            } catch (const std::exception&) {
+                usage(program_name, error);
+                error << "\nerror: \"" << *argv << "\" is not a valid integer argument for --journal-interval\n";
+                return 1;
+            }
+            // A chunk is read back whole when resuming.
+            if (value < 1 || value > 1024 * 1024 * 1024) {
+                usage(program_name, error);
+                error << "\nerror: --journal-interval argument must be between 1 and 1073741824.\n";
+                return 1;
+            }
+            options.journal_interval = value;
+        } else if (arg == "--adaptive") {
+            options.throttle.adaptive = true;
+        } else if (arg == "--ioprio") {
+            ++argv;
+            const std::string_view value = *argv ? *argv : "";
+            if (value == "idle") {
+                options.io_class = posix::IoClass::IDLE;
+            } else if (value == "best-effort") {
+                options.io_class = posix::IoClass::BEST_EFFORT;
+            } else if (value.size() == 13 && value.substr(0, 12) == "best-effort:" && value[12] >= '0' && value[12] <= '7') {
+                options.io_class = posix::IoClass::BEST_EFFORT;
+                options.io_level = value[12] - '0';
+            } else {
+                usage(program_name, error);
+                error << "\nerror: --ioprio requires \"idle\", \"best-effort\", or \"best-effort:LEVEL\" with LEVEL from 0 to 7.\n";
+                return 1;
+            }
+            options.set_io_priority = true;
+        } else if (arg == "--metrics") {
+            ++argv;
+            if (!*argv) {
+                usage(program_name, error);
+                error << "\nerror: --metrics requires a path argument.\n";
+                return 1;
+            }
+            const std::string_view value = *argv;
+            if (value.substr(0, 5) == "unix:") {
+                options.metrics.socket = value.substr(5);
+            } else {
+                options.metrics.path = value;
+            }
+        } else if (arg == "--metrics-interval") {
+            ++argv;
+            if (!*argv) {
+                usage(program_name, error);
+                error << "\nerror: --metrics-interval requires an integer argument.\n";
+                return 1;
+            }
+            long long value;
+            try {
+                value = std::stoll(*argv);
+            } catch (const std::exception&) {
+                usage(program_name, error);
+                error << "\nerror: \"" << *argv << "\" is not a valid integer argument for --metrics-interval\n";
+                return 1;
+            }
+            if (value < 1) {
+                usage(program_name, error);
+                error << "\nerror: --metrics-interval argument must be at least 1.\n";
+                return 1;
+            }
+            options.metrics.interval = std::chrono::milliseconds(value);
         } else if (arg.substr(0, 1) == "-") {
             usage(program_name, error);
             error << "\nerror: Unknown option \"" << arg << "\". If you meant a file name, use \"./" << arg << "\".\n";
@@ -137,6 +586,18 @@ int parse_command_line(Options& options, int argc, char* argv[], std::ostream& o
         }
     }
 
+    if (!options.buffer_cache.empty() && !options.auto_buffer) {
+        usage(program_name, error);
+        error << "\nerror: --buffer-cache requires --buffer auto.\n";
+        return 1;
+    }
+
+    if (options.throttle.adaptive && !options.throttle.bytes_per_second) {
+        usage(program_name, error);
+        error << "\nerror: --adaptive requires --rate.\n";
+        return 1;
+    }
+
     if (!found_destination) {
         usage(program_name, error);
         error << "\nsource file and destination file arguments are required.\n";
@@ -0,0 +1,91 @@
+#include "throttle.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace {
+
+// how much unused allowance a bucket can save up
+const std::chrono::milliseconds burst{100};
+
+// Advance `available_at` by the time that `cost` units take at `rate` units
+// per second, forgiving any time unused beyond the burst allowance. Return
+// the time at which the operation may start.
+std::chrono::steady_clock::time_point take(std::chrono::steady_clock::time_point& available_at, double cost, double rate, std::chrono::steady_clock::time_point now) {
+    available_at = std::max(available_at, now - burst);
+    const auto start = available_at;
+    available_at += std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(cost / rate));
+    return start;
+}
+
+} // namespace
+
+Throttle::Throttle(const ThrottleOptions& options)
+: options(options)
+, current_bytes_per_second(options.bytes_per_second)
+, bytes_available_at(Clock::now())
+, operations_available_at(bytes_available_at)
+, last_adjusted(bytes_available_at) {}
+
+bool Throttle::enabled() const {
+    return options.bytes_per_second > 0 || options.operations_per_second > 0;
+}
+
+std::size_t Throttle::suggested_chunk_size(std::size_t otherwise) const {
+    if (options.bytes_per_second <= 0) {
+        return otherwise;
+    }
+    // Small enough that a chunk doesn't blow the burst allowance, but not so
+    // small that the overhead of each operation dominates.
+    const double burst_bytes = options.bytes_per_second * std::chrono::duration<double>(burst).count();
+    return std::min(std::max<std::size_t>(burst_bytes, 4096), otherwise);
+}
+
+void Throttle::acquire(std::size_t bytes) {
+    const auto now = Clock::now();
+    auto start = now;
+    if (current_bytes_per_second > 0) {
+        start = std::max(start, take(bytes_available_at, bytes, current_bytes_per_second, now));
+    }
+    if (options.operations_per_second > 0) {
+        start = std::max(start, take(operations_available_at, 1, options.operations_per_second, now));
+    }
+    if (start > now) {
+        std::this_thread::sleep_until(start);
+    }
+}
+
+void Throttle::observe(Clock::duration latency) {
+    if (!options.adaptive || options.bytes_per_second <= 0) {
+        return;
+    }
+
+    const double seconds = std::chrono::duration<double>(latency).count();
+    const double weight = 0.1;
+    average_latency = average_latency == 0 ? seconds : (1 - weight) * average_latency + weight * seconds;
+    // The baseline is the lowest average seen, but it drifts upward slowly,
+    // so that an unrepresentatively fast start (e.g. writes absorbed by the
+    // page cache) doesn't throttle us forever.
+    baseline_latency = baseline_latency == 0 ? average_latency : std::min(baseline_latency * 1.001, average_latency);
+
+    // Adjust at most once per burst period, so that one adjustment can take
+    // effect before the next is considered.
+    const auto now = Clock::now();
+    if (now - last_adjusted < burst) {
+        return;
+    }
+    last_adjusted = now;
+
+    const double floor = options.bytes_per_second / 100;
+    if (average_latency > 2 * baseline_latency) {
+        // Multiplicative decrease...
+        current_bytes_per_second = std::max(floor, current_bytes_per_second / 2);
+    } else {
+        // ...additive increase.
+        current_bytes_per_second = std::min(options.bytes_per_second, current_bytes_per_second + options.bytes_per_second / 20);
+    }
+}
+
+double Throttle::bytes_per_second() const {
+    return current_bytes_per_second;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+// `Throttle` limits the rate of a copy loop to a number of bytes per second
+// and a number of operations (e.g. `write()` calls) per second. Each is a
+// token bucket that allows a burst of a tenth of a second's worth.
+//
+// In adaptive mode, the byte rate is treated as a ceiling. The observed
+// latency of operations is compared with the lowest latency seen so far, and
+// when it rises, presumably because somebody else now wants the device, the
+// rate is halved. While latency stays low, the rate creeps back up.
+struct ThrottleOptions {
+    // zero means unlimited
+    double bytes_per_second = 0;
+    // zero means unlimited
+    double operations_per_second = 0;
+    bool adaptive = false;
+};
+
+class Throttle {
+    using Clock = std::chrono::steady_clock;
+
+    ThrottleOptions options;
+    double current_bytes_per_second;
+    // The earliest time at which the next operation may start, according to
+    // each bucket. A bucket with tokens to spare has a time in the past.
+    Clock::time_point bytes_available_at;
+    Clock::time_point operations_available_at;
+    // exponentially weighted moving average of operation latency, in seconds
+    double average_latency = 0;
+    double baseline_latency = 0;
+    Clock::time_point last_adjusted;
+
+ public:
+    explicit Throttle(const ThrottleOptions& options);
+
+    // Return whether any limit is configured.
+    bool enabled() const;
+
+    // Return a good number of bytes for each operation, given the limits, or
+    // return `otherwise` if there is no byte rate limit.
+    std::size_t suggested_chunk_size(std::size_t otherwise) const;
+
+    // Wait until an operation transferring `bytes` bytes may start.
+    void acquire(std::size_t bytes);
+
+    // Report that the most recently acquired operation took `latency`. This
+    // matters only in adaptive mode.
+    void observe(Clock::duration latency);
+
+    // Return the byte rate currently in effect, which in adaptive mode is at
+    // most `options.bytes_per_second`.
+    double bytes_per_second() const;
+};
@@ -0,0 +1,424 @@
+#include "posix.h"
+#include "uring.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+struct Options {
+    bool help = false;
+    bool serial = false;
+    std::size_t batch = 256;
+    std::size_t max_size = 1024 * 1024;
+    std::size_t in_flight = 64 * 1024 * 1024;
+    std::string source;
+    std::string destination;
+};
+
+void usage(std::string_view name, std::ostream& out);
+
+int parse_command_line(Options& options, int argc, char* argv[], std::ostream& out, std::ostream& error);
+
+// Each file's copy is a chain of linked requests. A request's `user_data`
+// identifies the file (by index into the batch) and the step of its chain.
+enum Step : std::uint64_t {
+    STATUS,
+    OPEN_SOURCE,
+    READ,
+    OPEN_DESTINATION,
+    WRITE,
+    CLOSE_SOURCE,
+    CLOSE_DESTINATION,
+    STEP_COUNT
+};
+
+struct File {
+    const std::string* name;
+    struct statx status;
+    // `errno` value of the first failed step, or zero
+    int error;
+};
+
+class Batcher {
+    uring::Ring ring;
+    int source_directory;
+    int destination_directory;
+    std::size_t max_size;
+    // the most file data to hold in `buffer` at once
+    std::size_t in_flight;
+    std::vector<char> buffer;
+
+    io_uring_sqe* prepare(std::size_t file, Step step);
+    // Submit the prepared requests, wait for `count` completions, and record
+    // the first error of each file in `files`. Return zero on success, or
+    // return `errno` if the ring itself fails.
+    int complete(std::vector<File>& files, unsigned count);
+
+ public:
+    Batcher(int source_directory, int destination_directory, std::size_t max_size, std::size_t in_flight)
+    : source_directory(source_directory), destination_directory(destination_directory), max_size(max_size), in_flight(in_flight) {}
+
+    // Prepare to copy batches of up to `batch` files. Return zero on success,
+    // or return `errno` if an error occurs. In particular, return `ENOSYS` if
+    // the kernel is too old for the requests that `copy` uses.
+    int initialize(std::size_t batch);
+
+    // Copy `files` that are regular files no larger than `max_size` bytes,
+    // splitting them into as many submissions as needed to keep at most
+    // `in_flight` bytes in memory. Append the other regular files to
+    // `oversized`. Set the `error` of each file that could not be copied.
+    // Return zero on success, or return `errno` if the ring itself fails.
+    int copy(std::vector<File>& files, std::vector<const std::string*>& oversized);
+};
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (const int rc = parse_command_line(options, argc, argv, std::cout, std::cerr)) {
+        return rc;
+    } else if (options.help) {
+        return 0; // `parse_command_line` printed the usage already
+    }
+
+    std::vector<std::string> names;
+    if (const int rc = posix::list_directory(options.source.c_str(), names)) {
+        std::cerr << "Unable to list the contents of \"" << options.source << "\": " << std::strerror(rc) << '\n';
+        return 1;
+    }
+
+    int status = 0;
+    const auto copy_one = [&](const std::string& name) {
+        const std::string source = options.source + '/' + name;
+        const std::string destination = options.destination + '/' + name;
+        if (const int rc = posix::copy_all(source.c_str(), destination.c_str())) {
+            std::cerr << "Unable to copy bytes from \"" << source << "\" to \"" << destination << "\": " << std::strerror(rc) << '\n';
+            status = 1;
+        }
+    };
+
+    if (options.serial) {
+        for (const std::string& name : names) {
+            copy_one(name);
+        }
+        return status;
+    }
+
+    class Closer {
+        int fd;
+     public:
+        explicit Closer(int fd) : fd(fd) {}
+        ~Closer() {
+            posix::close_file(fd);
+        }
+    };
+
+    const int source_directory = posix::open_directory(options.source.c_str());
+    if (source_directory < 0) {
+        std::cerr << "Unable to open directory \"" << options.source << "\": " << std::strerror(-source_directory) << '\n';
+        return 1;
+    }
+    Closer source_closer{source_directory};
+
+    const int destination_directory = posix::open_directory(options.destination.c_str());
+    if (destination_directory < 0) {
+        std::cerr << "Unable to open directory \"" << options.destination << "\": " << std::strerror(-destination_directory) << '\n';
+        return 1;
+    }
+    Closer destination_closer{destination_directory};
+
+    Batcher batcher{source_directory, destination_directory, options.max_size, options.in_flight};
+    if (const int rc = batcher.initialize(options.batch)) {
+        std::cerr << "Unable to set up io_uring: " << std::strerror(rc) << '\n';
+        if (rc == ENOSYS) {
+            std::cerr << "uring-batch requires Linux 5.19 or later. Use --serial on older kernels.\n";
+        }
+        return 1;
+    }
+
+    std::vector<const std::string*> oversized;
+    std::vector<File> files;
+    for (std::size_t begin = 0; begin < names.size(); begin += options.batch) {
+        files.clear();
+        for (std::size_t i = begin; i < names.size() && i < begin + options.batch; ++i) {
+            files.push_back({.name = &names[i], .status = {}, .error = 0});
+        }
+        if (const int rc = batcher.copy(files, oversized)) {
+            std::cerr << "io_uring failed: " << std::strerror(rc) << '\n';
+            return 1;
+        }
+        for (const File& file : files) {
+            if (file.error) {
+                std::cerr << "Unable to copy bytes from \"" << options.source << '/' << *file.name << "\" to \""
+                          << options.destination << '/' << *file.name << "\": " << std::strerror(file.error) << '\n';
+                status = 1;
+            }
+        }
+    }
+
+    // Files too large to read in one request don't benefit from batching.
+    for (const std::string* name : oversized) {
+        copy_one(*name);
+    }
+
+    return status;
+}
+
+int Batcher::initialize(std::size_t batch) {
+    if (const int rc = ring.initialize(batch * (STEP_COUNT - 1))) {
+        return rc;
+    }
+    // Each chain opens files into slots and then refers to the slots. Older
+    // kernels look up a linked request's fixed file when it's submitted,
+    // before the open ahead of it in the chain has happened.
+    if (!(ring.features() & IORING_FEAT_LINKED_FILE)) {
+        return ENOSYS;
+    }
+    // Each file in the batch gets one slot for its source and one for its
+    // destination.
+    return ring.register_file_slots(batch * 2);
+}
+
+io_uring_sqe* Batcher::prepare(std::size_t file, Step step) {
+    // `initialize` sized the ring to fit a whole batch.
+    io_uring_sqe* const entry = ring.next_submission();
+    entry->user_data = file * STEP_COUNT + step;
+    return entry;
+}
+
+int Batcher::complete(std::vector<File>& files, unsigned count) {
+    if (const int rc = ring.submit_and_wait(count)) {
+        return rc;
+    }
+    io_uring_cqe completion;
+    while (ring.next_completion(completion)) {
+        File& file = files[completion.user_data / STEP_COUNT];
+        const auto step = Step(completion.user_data % STEP_COUNT);
+        // Once a step fails, the rest of the chain is canceled. Report the
+        // original failure. A failed close counts too, because it can be how
+        // a delayed write error is reported.
+        if (file.error) {
+            continue;
+        }
+        if (completion.res < 0) {
+            file.error = -completion.res;
+        } else if (step == READ && std::uint64_t(completion.res) != file.status.stx_size) {
+            file.error = EIO; // the file changed size since we looked
+        } else if (step == WRITE && std::uint64_t(completion.res) != file.status.stx_size) {
+            // A short write ends the chain like a failed one, but doesn't say
+            // why. The closes after it are canceled, so this is the only
+            // report of it.
+            file.error = EIO;
+        }
+    }
+    return 0;
+}
+
+int Batcher::copy(std::vector<File>& files, std::vector<const std::string*>& oversized) {
+    // First, learn the size and mode of every file in one submission. A
+    // chain can't feed one request's result into the next, so the reads need
+    // to know their sizes in advance.
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        io_uring_sqe* const entry = prepare(i, STATUS);
+        entry->opcode = IORING_OP_STATX;
+        entry->fd = source_directory;
+        entry->addr = reinterpret_cast<std::uint64_t>(files[i].name->c_str());
+        entry->len = STATX_TYPE | STATX_MODE | STATX_SIZE;
+        entry->off = reinterpret_cast<std::uint64_t>(&files[i].status);
+    }
+    if (const int rc = complete(files, files.size())) {
+        return rc;
+    }
+
+    std::size_t total = 0;
+    for (const File& file : files) {
+        if (!file.error && S_ISREG(file.status.stx_mode) && file.status.stx_size <= max_size) {
+            total += file.status.stx_size;
+        }
+    }
+    if (buffer.size() < std::min(total, in_flight)) {
+        buffer.resize(std::min(total, in_flight));
+    }
+
+    // Then, copy every file that fits using one chain per file: open the
+    // source, read it, open the destination, write it, and close both. The
+    // files are opened into registered slots, so no file descriptor is ever
+    // returned to us. When the buffer is full, finish the chains so far and
+    // start again at its beginning.
+    unsigned count = 0;
+    std::size_t used = 0;
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        File& file = files[i];
+        if (file.error || !S_ISREG(file.status.stx_mode)) {
+            continue; // not a regular file: skip it
+        }
+        if (file.status.stx_size > max_size) {
+            oversized.push_back(file.name);
+            continue;
+        }
+        const std::uint32_t size = file.status.stx_size;
+        if (used + size > buffer.size()) {
+            if (const int rc = complete(files, count)) {
+                return rc;
+            }
+            count = 0;
+            used = 0;
+        }
+        const unsigned source_slot = i * 2;
+        const unsigned destination_slot = i * 2 + 1;
+        char* const data = buffer.data() + used;
+        used += size;
+
+        io_uring_sqe* entry = prepare(i, OPEN_SOURCE);
+        entry->opcode = IORING_OP_OPENAT;
+        entry->flags = IOSQE_IO_LINK;
+        entry->fd = source_directory;
+        entry->addr = reinterpret_cast<std::uint64_t>(file.name->c_str());
+        entry->open_flags = O_RDONLY;
+        entry->file_index = source_slot + 1;
+
+        entry = prepare(i, READ);
+        entry->opcode = IORING_OP_READ;
+        entry->flags = IOSQE_IO_LINK | IOSQE_FIXED_FILE;
+        entry->fd = source_slot;
+        entry->addr = reinterpret_cast<std::uint64_t>(data);
+        entry->len = size;
+
+        entry = prepare(i, OPEN_DESTINATION);
+        entry->opcode = IORING_OP_OPENAT;
+        entry->flags = IOSQE_IO_LINK;
+        entry->fd = destination_directory;
+        entry->addr = reinterpret_cast<std::uint64_t>(file.name->c_str());
+        entry->open_flags = O_WRONLY | O_CREAT | O_TRUNC;
+        entry->len = file.status.stx_mode & 07777;
+        entry->file_index = destination_slot + 1;
+
+        entry = prepare(i, WRITE);
+        entry->opcode = IORING_OP_WRITE;
+        entry->flags = IOSQE_IO_LINK | IOSQE_FIXED_FILE;
+        entry->fd = destination_slot;
+        entry->addr = reinterpret_cast<std::uint64_t>(data);
+        entry->len = size;
+
+        // If the chain breaks before here, the slots stay occupied until the
+        // next batch opens files into them, which replaces them.
+        entry = prepare(i, CLOSE_SOURCE);
+        entry->opcode = IORING_OP_CLOSE;
+        entry->flags = IOSQE_IO_LINK;
+        entry->file_index = source_slot + 1;
+
+        entry = prepare(i, CLOSE_DESTINATION);
+        entry->opcode = IORING_OP_CLOSE;
+        entry->file_index = destination_slot + 1;
+
+        count += STEP_COUNT - 1;
+    }
+
+    return complete(files, count);
+}
+
+void usage(std::string_view program_name, std::ostream& out) {
+    out << "usage:\n\n"
+        "    " << program_name << " [--help | -h] [--batch COUNT] [--max-size BYTES] [--in-flight LIMIT] [--serial]\n"
+        "        <source directory> <destination directory>\n\n"
+        "        --help or -h prints this message.\n"
+        "        COUNT is the number of files copied per io_uring submission. It defaults to 256.\n"
+        "        BYTES is the size of the largest file to copy using io_uring. Larger files are copied\n"
+        "            one at a time, as by the copy program. It defaults to 1048576 (one mebibyte).\n"
+        "        LIMIT is the most bytes of file data to hold in memory at once. A batch whose files are\n"
+        "            larger in total is split. It defaults to 67108864 (64 mebibytes), and must be at least BYTES.\n"
+        "        --serial copies every file one at a time, as by the copy program, for comparison.\n"
+        "        <source directory> contains the regular files to copy. Subdirectories are not copied.\n"
+        "        <destination directory> is the existing directory into which the files are copied.\n\n"
+        "    It requires Linux 5.19 or later, except with --serial.\n";
+}
+
+int parse_command_line(Options& options, int argc, char* argv[], std::ostream& out, std::ostream& error) {
+    const std::string_view program_name =  argv[0];
+    if (argc < 1 + 1 || argc > 1 + 2 + 2 + 2 + 1 + 2) {
+        usage(program_name, error);
+        return 1;
+    }
+
+    bool found_source = false;
+    bool found_destination = false;
+
+    for (++argv; *argv; ++argv) {
+        const std::string_view arg = *argv;
+        if (arg == "--help" || arg == "-h") {
+            options.help = true;
+            usage(program_name, out);
+            return 0;
+        } else if (arg == "--serial") {
+            options.serial = true;
+        } else if (arg == "--batch" || arg == "--max-size" || arg == "--in-flight") {
+            ++argv;
+            if (!*argv) {
+                usage(program_name, error);
+                error << "\nerror: " << arg << " requires an integer argument.\n";
+                return 1;
+            }
+            long long value;
+            try {
+                value = std::stoll(*argv);
+            } catch (const std::exception&) {
+                usage(program_name, error);
+                error << "\nerror: \"" << *argv << "\" is not a valid integer argument for " << arg << '\n';
+                return 1;
+            }
+            if (arg == "--batch" && (value < 1 || value > 4096)) {
+                usage(program_name, error);
+                error << "\nerror: --batch argument must be between 1 and 4096.\n";
+                return 1;
+            }
+            // A single read or write request transfers at most this much.
+            if (arg == "--max-size" && (value < 0 || value > 0x7ffff000)) {
+                usage(program_name, error);
+                error << "\nerror: --max-size argument must be between 0 and 2147479552.\n";
+                return 1;
+            }
+            if (arg == "--in-flight" && value < 1) {
+                usage(program_name, error);
+                error << "\nerror: --in-flight argument must be at least 1.\n";
+                return 1;
+            }
+            (arg == "--batch" ? options.batch : arg == "--max-size" ? options.max_size : options.in_flight) = value;
+        } else if (arg.substr(0, 1) == "-") {
+            usage(program_name, error);
+            error << "\nerror: Unknown option \"" << arg << "\". If you meant a directory name, use \"./" << arg << "\".\n";
+            return 1;
+        } else if (found_source && found_destination) {
+            usage(program_name, error);
+            return 1;
+        } else if (found_source) {
+            options.destination = arg;
+            found_destination = true;
+        } else {
+            options.source = arg;
+            found_source = true;
+        }
+    }
+
+    if (!found_destination) {
+        usage(program_name, error);
+        error << "\nsource directory and destination directory arguments are required.\n";
+        return 1;
+    }
+
+    // Every file copied using io_uring must fit in the buffer by itself.
+    if (options.in_flight < options.max_size) {
+        usage(program_name, error);
+        error << "\nerror: --in-flight argument must be at least the --max-size argument.\n";
+        return 1;
+    }
+
+    return 0;
+}
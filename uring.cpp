@@ -0,0 +1,154 @@
+#include "uring.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace uring {
+namespace {
+
+unsigned load_acquire(unsigned* value) {
+    return std::atomic_ref<unsigned>(*value).load(std::memory_order_acquire);
+}
+
+void store_release(unsigned* value, unsigned new_value) {
+    std::atomic_ref<unsigned>(*value).store(new_value, std::memory_order_release);
+}
+
+void* map_ring(int fd, std::size_t size, off_t offset) {
+    void* address = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+    return address == MAP_FAILED ? nullptr : address;
+}
+
+} // namespace
+
+Ring::~Ring() {
+    if (entries) {
+        ::munmap(entries, entries_size);
+    }
+    if (completion_ring && completion_ring != submission_ring) {
+        ::munmap(completion_ring, completion_ring_size);
+    }
+    if (submission_ring) {
+        ::munmap(submission_ring, submission_ring_size);
+    }
+    if (fd != -1) {
+        ::close(fd);
+    }
+}
+
+int Ring::initialize(unsigned count) {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof params);
+    const int rc = ::syscall(__NR_io_uring_setup, count, &params);
+    if (rc == -1) {
+        return errno;
+    }
+    fd = rc;
+    kernel_features = params.features;
+
+    submission_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    completion_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    // Since Linux 5.4, both rings live in one mapping.
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        submission_ring_size = completion_ring_size = std::max(submission_ring_size, completion_ring_size);
+    }
+
+    submission_ring = map_ring(fd, submission_ring_size, IORING_OFF_SQ_RING);
+    if (!submission_ring) {
+        return errno;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        completion_ring = submission_ring;
+    } else if (!(completion_ring = map_ring(fd, completion_ring_size, IORING_OFF_CQ_RING))) {
+        return errno;
+    }
+    entries_size = params.sq_entries * sizeof(io_uring_sqe);
+    entries = static_cast<io_uring_sqe*>(map_ring(fd, entries_size, IORING_OFF_SQES));
+    if (!entries) {
+        return errno;
+    }
+
+    char* const sq = static_cast<char*>(submission_ring);
+    submission_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    submission_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    submission_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    submission_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    submission_capacity = params.sq_entries;
+
+    char* const cq = static_cast<char*>(completion_ring);
+    completion_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    completion_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    completion_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    completions = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    return 0;
+}
+
+unsigned Ring::features() const {
+    return kernel_features;
+}
+
+int Ring::register_file_slots(unsigned count) {
+    // -1 marks a slot as empty.
+    const std::vector<int> slots(count, -1);
+    if (::syscall(__NR_io_uring_register, fd, IORING_REGISTER_FILES, slots.data(), count) == -1) {
+        return errno;
+    }
+    return 0;
+}
+
+io_uring_sqe* Ring::next_submission() {
+    const unsigned tail = *submission_tail + pending;
+    if (tail - load_acquire(submission_head) == submission_capacity) {
+        return nullptr;
+    }
+    const unsigned index = tail & submission_mask;
+    io_uring_sqe* const entry = &entries[index];
+    std::memset(entry, 0, sizeof *entry);
+    submission_array[index] = index;
+    ++pending;
+    return entry;
+}
+
+int Ring::submit_and_wait(unsigned count) {
+    const unsigned to_submit = pending;
+    store_release(submission_tail, *submission_tail + pending);
+    pending = 0;
+
+    int rc;
+    do {
+        // If the kernel already consumed some of the submissions before the
+        // interruption, then it submits only what remains.
+        rc = ::syscall(__NR_io_uring_enter, fd, to_submit, count, IORING_ENTER_GETEVENTS, nullptr, 0);
+    } while (rc == -1 && errno == EINTR);
+    if (rc == -1) {
+        return errno;
+    }
+    // A signal can also end the wait early without an error.
+    while (load_acquire(completion_tail) - *completion_head < count) {
+        rc = ::syscall(__NR_io_uring_enter, fd, 0, count, IORING_ENTER_GETEVENTS, nullptr, 0);
+        if (rc == -1 && errno != EINTR) {
+            return errno;
+        }
+    }
+    return 0;
+}
+
+bool Ring::next_completion(io_uring_cqe& completion) {
+    const unsigned head = *completion_head;
+    if (head == load_acquire(completion_tail)) {
+        return false;
+    }
+    completion = completions[head & completion_mask];
+    store_release(completion_head, head + 1);
+    return true;
+}
+
+} // namespace uring
@@ -0,0 +1,71 @@
+#pragma once
+
+// This is a minimal io_uring interface, just enough for `uring-batch`. It
+// speaks to the kernel directly, rather than through liburing, so that the
+// build has no dependencies beyond the kernel's headers. It is Linux-only.
+
+#include <cstddef>
+
+#include <linux/io_uring.h>
+
+namespace uring {
+
+class Ring {
+    int fd = -1;
+    void* submission_ring = nullptr;
+    std::size_t submission_ring_size = 0;
+    void* completion_ring = nullptr;
+    std::size_t completion_ring_size = 0;
+    io_uring_sqe* entries = nullptr;
+    std::size_t entries_size = 0;
+
+    unsigned* submission_head = nullptr;
+    unsigned* submission_tail = nullptr;
+    unsigned submission_mask = 0;
+    unsigned* submission_array = nullptr;
+    unsigned submission_capacity = 0;
+    // submissions prepared by `next_submission` but not yet given to the kernel
+    unsigned pending = 0;
+
+    unsigned* completion_head = nullptr;
+    unsigned* completion_tail = nullptr;
+    unsigned completion_mask = 0;
+    io_uring_cqe* completions = nullptr;
+
+    // `IORING_FEAT_*` flags that the kernel reported
+    unsigned kernel_features = 0;
+
+ public:
+    Ring() = default;
+    Ring(const Ring&) = delete;
+    Ring& operator=(const Ring&) = delete;
+    ~Ring();
+
+    // Create the kernel's ring having room for at least `count` submissions,
+    // and at least twice as many completions. Return zero on success, or
+    // return `errno` if an error occurs.
+    int initialize(unsigned count);
+
+    // Return the `IORING_FEAT_*` flags of the kernel's ring.
+    unsigned features() const;
+
+    // Register a table of `count` empty file slots that requests can open
+    // files into and refer to with `IOSQE_FIXED_FILE`. Return zero on
+    // success, or return `errno` if an error occurs.
+    int register_file_slots(unsigned count);
+
+    // Return a zeroed submission queue entry to fill in, or return `nullptr`
+    // if the submission queue is full.
+    io_uring_sqe* next_submission();
+
+    // Give all prepared submissions to the kernel and wait until at least
+    // `count` completions are available, all in one system call. Return zero
+    // on success, or return `errno` if an error occurs.
+    int submit_and_wait(unsigned count);
+
+    // If a completion is available, copy it into `completion`, consume it, and
+    // return `true`. Otherwise, return `false`.
+    bool next_completion(io_uring_cqe& completion);
+};
+
+} // namespace uring